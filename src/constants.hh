@@ -17,6 +17,14 @@ namespace vcat::constants {
 	constexpr AVColorTransferCharacteristic COLOR_TRANSFER_FUNCTION = AVCOL_TRC_BT709;
 	constexpr AVColorRange                  COLOR_RANGE             = AVCOL_RANGE_MPEG;
 
+	// The number of reference frames and the keyframe interval (in seconds) used by the video encoder
+	constexpr int    ENCODER_REFS = 3;
+	constexpr double ENCODER_GOP_SECONDS = 2.0;
+
+	// This must be changed whenever the encoder configuration changes so that cached streams from an older
+	// configuration (which cannot be spliced with new ones) are not used.
+	constexpr uint64_t ENCODER_CONFIG_VERSION = 1;
+
 	constexpr uint64_t CHANNEL_LAYOUT = AV_CH_LAYOUT_STEREO;
 	constexpr size_t SAMPLES_PER_FRAME = 1024;
 
@@ -2,15 +2,32 @@
 #include "src/eval/eobject.hh"
 #include "src/eval/error.hh"
 #include "src/filter/filter.hh"
+#include "src/filter/blank.hh"
 #include "src/filter/concat.hh"
+#include "src/filter/crossfade.hh"
+#include "src/filter/error.hh"
+#include "src/filter/repeat.hh"
+#include "src/filter/speed.hh"
+#include "src/filter/still.hh"
+#include "src/filter/trim.hh"
 #include "src/filter/video_file.hh"
 #include "src/eval/builtins.hh"
+#include "src/constants.hh"
 
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <string>
 #include <optional>
 #include <ranges>
 #include <span>
+#include <string_view>
 #include <utility>
 
+extern "C" {
+	#include <libavutil/rational.h>
+}
+
 namespace vcat::eval::builtins {
 	// Opens a video file
 	const EObject& vopen(EObjectPool& pool, const Spanned<const EList&> args) {
@@ -37,10 +54,10 @@ namespace vcat::eval::builtins {
 		}
 	}
 
-	const EObject& concat(EObjectPool& pool, Spanned<const EList&> args) {
-		std::vector<Spanned<const EObject&>> args_to_parse = {Spanned<const EObject&>(*args, args.span)};
-
-		std::vector<Spanned<const filter::VFilter&>> videos;
+	// Collects the videos in a (possibly nested) list of videos. Repeated lists become `Repeat` filters instead of
+	// being expanded.
+	static void flatten_videos(EObjectPool& pool, Spanned<const EObject&> object, std::vector<Spanned<const filter::VFilter&>>& videos) {
+		std::vector<Spanned<const EObject&>> args_to_parse = {object};
 
 		while(!args_to_parse.empty()) {
 			Spanned<const EObject&> arg = args_to_parse.back();
@@ -55,6 +72,38 @@ namespace vcat::eval::builtins {
 				continue;
 			}
 
+			const ERepeatedList *repeated_list = dynamic_cast<const ERepeatedList*>(&*arg);
+			if(repeated_list) {
+				std::vector<Spanned<const filter::VFilter&>> element_videos;
+				flatten_videos(pool, repeated_list->element(), element_videos);
+
+				if(element_videos.empty() || repeated_list->count() == 0) {
+					continue;
+				}
+
+				if(repeated_list->count() == 1) {
+					for(const auto& video : element_videos) {
+						videos.push_back(video);
+					}
+
+					continue;
+				}
+
+				const Span element_span = repeated_list->element().span;
+
+				const filter::VFilter& element = element_videos.size() == 1
+					? element_videos[0].val
+					: pool.add<filter::Concat>(std::move(element_videos), element_span);
+
+				const filter::Repeat& repeat = pool.add<filter::Repeat>(
+					Spanned<const filter::VFilter&>(element, element_span),
+					repeated_list->count()
+				);
+
+				videos.push_back(Spanned<const filter::VFilter&>(repeat, arg.span));
+				continue;
+			}
+
 			const filter::VFilter *video = dynamic_cast<const filter::VFilter *>(&*arg);
 			if(!video) {
 				throw error::expected_video_or_list(*arg, arg.span);
@@ -62,6 +111,12 @@ namespace vcat::eval::builtins {
 
 			videos.push_back(Spanned<const filter::VFilter&>(*video, arg.span));
 		}
+	}
+
+	const EObject& concat(EObjectPool& pool, Spanned<const EList&> args) {
+		std::vector<Spanned<const filter::VFilter&>> videos;
+
+		flatten_videos(pool, Spanned<const EObject&>(*args, args.span), videos);
 
 		return pool.add<filter::Concat>(std::move(videos), args.span);
 	}
@@ -98,13 +153,288 @@ namespace vcat::eval::builtins {
 			throw eval::error::expected_positive_number(args->elements()[1].span, **num_reps);
 		}
 
-		std::vector<Spanned<const EObject&>> elements;
+		return pool.add<ERepeatedList>(args->elements()[0], static_cast<size_t>(**num_reps));
+	}
+
+	// Parses a timestamp (either an Integer number of seconds or a String of the form
+	// `[[hours:]minutes:]seconds[.fraction]`) into `constants::TIMEBASE`
+	static int64_t parse_timestamp(Spanned<const EObject&> arg) {
+		if(const EInteger *seconds = dynamic_cast<const EInteger *>(&*arg)) {
+			if(**seconds < 0) {
+				throw eval::error::expected_positive_number(arg.span, **seconds);
+			}
+
+			return **seconds * constants::TIMEBASE.den / constants::TIMEBASE.num;
+		}
+
+		const EString *string = dynamic_cast<const EString *>(&*arg);
+		if(!string) {
+			throw eval::error::expected_argument_of_type(arg.span, "Timestamp", *arg);
+		}
+
+		const std::string_view timestamp = **string;
+
+		double seconds = 0.0;
+		size_t num_parts = 0;
 
-		for(int64_t i = 0; i < **num_reps; i++) {
-			elements.push_back(args->elements()[0]);
+		for(const auto part : std::views::split(timestamp, ':')) {
+			const std::string_view part_str(part.begin(), part.end());
+
+			double value;
+			const auto res = std::from_chars(part_str.data(), part_str.data() + part_str.size(), value, std::chars_format::fixed);
+
+			num_parts++;
+
+			if(
+				part_str.empty()                              ||
+				res.ec != std::errc()                         ||
+				res.ptr != part_str.data() + part_str.size() ||
+				value < 0.0                                   ||
+				num_parts > 3                                 ||
+				(num_parts > 1 && value >= 60.0)
+			) {
+				throw eval::error::invalid_timestamp(timestamp, arg.span);
+			}
+
+			seconds = seconds * 60.0 + value;
 		}
 
-		return pool.add<EList>(std::move(elements));
+		return std::llround(seconds * constants::TIMEBASE.den / constants::TIMEBASE.num);
 	}
-}
 
+	const EObject& trim(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 3) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(3)));
+		}
+
+		const Span end_of_args = Span(args.span.start + args.span.length - 1, 1);
+
+		if(elements.empty()) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Video", {});
+		}
+
+		const filter::VFilter *video = dynamic_cast<const filter::VFilter *>(&*elements[0]);
+		if(!video) {
+			throw eval::error::expected_argument_of_type(elements[0].span, "Video", *elements[0]);
+		}
+
+		if(elements.size() < 2) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Timestamp", {});
+		}
+
+		filter::TimeRange range {
+			.start = parse_timestamp(elements[1]),
+			.end   = std::nullopt,
+		};
+
+		if(elements.size() == 3) {
+			range.end = parse_timestamp(elements[2]);
+
+			if(*range.end <= range.start) {
+				throw filter::error::empty_range(*span_of(elements.subspan(1)));
+			}
+		}
+
+		return pool.add<filter::Trim>(Spanned<const filter::VFilter&>(*video, elements[0].span), range);
+	}
+
+	// Parses a speed factor (either an Integer or a String with a decimal number or a fraction, ie `"1.5"` or
+	// `"1/3"`)
+	static AVRational parse_factor(Spanned<const EObject&> arg) {
+		if(const EInteger *factor = dynamic_cast<const EInteger *>(&*arg)) {
+			if(**factor <= 0 || **factor > INT_MAX) {
+				throw eval::error::invalid_speed(std::to_string(**factor), arg.span);
+			}
+
+			return AVRational {static_cast<int>(**factor), 1};
+		}
+
+		const EString *string = dynamic_cast<const EString *>(&*arg);
+		if(!string) {
+			throw eval::error::expected_argument_of_type(arg.span, "Speed", *arg);
+		}
+
+		const std::string_view factor_str = **string;
+		const char *const str_end = factor_str.data() + factor_str.size();
+
+		AVRational factor;
+
+		if(const size_t slash = factor_str.find('/'); slash != std::string_view::npos) {
+			int64_t num, den;
+
+			const auto num_res = std::from_chars(factor_str.data(), factor_str.data() + slash, num);
+			const auto den_res = std::from_chars(factor_str.data() + slash + 1, str_end, den);
+
+			if(
+				num_res.ec != std::errc() || num_res.ptr != factor_str.data() + slash ||
+				den_res.ec != std::errc() || den_res.ptr != str_end                   ||
+				num <= 0 || den <= 0
+			) {
+				throw eval::error::invalid_speed(factor_str, arg.span);
+			}
+
+			av_reduce(&factor.num, &factor.den, num, den, INT_MAX);
+		} else {
+			double value;
+			const auto res = std::from_chars(factor_str.data(), str_end, value, std::chars_format::fixed);
+
+			if(res.ec != std::errc() || res.ptr != str_end || !(value > 0.0)) {
+				throw eval::error::invalid_speed(factor_str, arg.span);
+			}
+
+			factor = av_d2q(value, INT_MAX);
+		}
+
+		if(factor.num <= 0 || factor.den <= 0) {
+			throw eval::error::invalid_speed(factor_str, arg.span);
+		}
+
+		return factor;
+	}
+
+	const EObject& speed(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 2) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(2)));
+		}
+
+		const Span end_of_args = Span(args.span.start + args.span.length - 1, 1);
+
+		if(elements.empty()) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Video", {});
+		}
+
+		const filter::VFilter *video = dynamic_cast<const filter::VFilter *>(&*elements[0]);
+		if(!video) {
+			throw eval::error::expected_argument_of_type(elements[0].span, "Video", *elements[0]);
+		}
+
+		if(elements.size() < 2) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Speed", {});
+		}
+
+		return pool.add<filter::Speed>(Spanned<const filter::VFilter&>(*video, elements[0].span), parse_factor(elements[1]));
+	}
+
+	const EObject& crossfade(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 3) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(3)));
+		}
+
+		const Span end_of_args = Span(args.span.start + args.span.length - 1, 1);
+
+		std::vector<Spanned<const filter::VFilter&>> videos;
+
+		for(size_t i = 0; i < 2; i++) {
+			if(elements.size() <= i) {
+				throw eval::error::expected_argument_of_type(end_of_args, "Video", {});
+			}
+
+			const filter::VFilter *video = dynamic_cast<const filter::VFilter *>(&*elements[i]);
+			if(!video) {
+				throw eval::error::expected_argument_of_type(elements[i].span, "Video", *elements[i]);
+			}
+
+			videos.push_back(Spanned<const filter::VFilter&>(*video, elements[i].span));
+		}
+
+		if(elements.size() < 3) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Timestamp", {});
+		}
+
+		const int64_t duration = parse_timestamp(elements[2]);
+
+		if(duration <= 0) {
+			throw eval::error::zero_duration(elements[2].span);
+		}
+
+		return pool.add<filter::Crossfade>(videos[0], videos[1], duration);
+	}
+
+	const EObject& blank(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 1) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(1)));
+		}
+
+		if(elements.empty()) {
+			throw eval::error::expected_argument_of_type(Span(args.span.start + args.span.length - 1, 1), "Timestamp", {});
+		}
+
+		const int64_t duration = parse_timestamp(elements[0]);
+
+		if(duration <= 0) {
+			throw eval::error::zero_duration(elements[0].span);
+		}
+
+		return pool.add<filter::Blank>(duration);
+	}
+
+	const EObject& silence(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 1) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(1)));
+		}
+
+		if(elements.empty()) {
+			throw eval::error::expected_argument_of_type(Span(args.span.start + args.span.length - 1, 1), "Video", {});
+		}
+
+		const filter::VFilter *video = dynamic_cast<const filter::VFilter *>(&*elements[0]);
+		if(!video) {
+			throw eval::error::expected_argument_of_type(elements[0].span, "Video", *elements[0]);
+		}
+
+		return pool.add<filter::Silence>(Spanned<const filter::VFilter&>(*video, elements[0].span));
+	}
+
+	const EObject& still(EObjectPool& pool, Spanned<const EList&> args) {
+		const std::span<const Spanned<const EObject&>> elements = args->elements();
+
+		if(elements.size() > 2) {
+			throw eval::error::unexpected_arguments(*span_of(elements.subspan(2)));
+		}
+
+		const Span end_of_args = Span(args.span.start + args.span.length - 1, 1);
+
+		if(elements.empty()) {
+			throw eval::error::expected_file_path(end_of_args, {});
+		}
+
+		// The image can either be a path or an already opened file
+		const filter::VideoFile *image = dynamic_cast<const filter::VideoFile *>(&*elements[0]);
+
+		if(!image) {
+			const EString *path_ptr = dynamic_cast<const EString *>(&*elements[0]);
+
+			if(!path_ptr) {
+				throw eval::error::expected_file_path(elements[0].span, *elements[0]);
+			}
+
+			try {
+				image = &pool.add<vcat::filter::VideoFile>(std::string(**path_ptr));
+			} catch(std::string err) {
+				throw Diagnostic(std::move(err), {Diagnostic::Hint::error("", elements[0].span)});
+			}
+		}
+
+		if(elements.size() < 2) {
+			throw eval::error::expected_argument_of_type(end_of_args, "Timestamp", {});
+		}
+
+		const int64_t duration = parse_timestamp(elements[1]);
+
+		if(duration <= 0) {
+			throw eval::error::zero_duration(elements[1].span);
+		}
+
+		return pool.add<filter::Still>(Spanned<const filter::VideoFile&>(*image, elements[0].span), duration);
+	}
+}
@@ -9,5 +9,17 @@ namespace vcat::eval::builtins {
 	const EObject& concat(EObjectPool& pool, Spanned<const EList&> args);
 	// Creates a list of an object repeated n times
 	const EObject& repeat(EObjectPool& pool, Spanned<const EList&> args);
+	// Cuts a video down to a time range
+	const EObject& trim(EObjectPool& pool, Spanned<const EList&> args);
+	// Speeds up or slows down a video
+	const EObject& speed(EObjectPool& pool, Spanned<const EList&> args);
+	// Fades the end of one video into the start of another
+	const EObject& crossfade(EObjectPool& pool, Spanned<const EList&> args);
+	// Creates black video with silent audio
+	const EObject& blank(EObjectPool& pool, Spanned<const EList&> args);
+	// Replaces the audio of a video with silence
+	const EObject& silence(EObjectPool& pool, Spanned<const EList&> args);
+	// Shows an image for some time
+	const EObject& still(EObjectPool& pool, Spanned<const EList&> args);
 }
 
@@ -56,6 +56,31 @@ namespace vcat {
 		return "List";
 	}
 
+	void ERepeatedList::hash(vcat::Hasher& hasher) const {
+		hasher.add("_repeated-list_");
+		const size_t inner_start = hasher.pos();
+
+		m_element->hash(hasher);
+		hasher.add((uint64_t) m_count);
+
+		hasher.add((uint64_t) (hasher.pos() - inner_start));
+	}
+
+	std::string ERepeatedList::to_string() const {
+		std::stringstream s;
+
+		s << "repeat(\n"
+			<< indent(m_element->to_string()) << ",\n"
+			<< indent(std::to_string(m_count))
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string ERepeatedList::type_name() const {
+		return "List";
+	}
+
 	void EString::hash(vcat::Hasher& hasher) const {
 		hasher.add("_string_");
 		hasher.add(m_string);
@@ -105,6 +105,35 @@ namespace vcat {
 	};
 	static_assert(!std::is_abstract<EList>());
 
+	// A list that contains the same element `count` times (ie from `repeat`). The element is only stored once, so
+	// large repetitions don't have to be expanded.
+	//
+	// NOTE: the hash is not the same as the hash of the expanded list (hashing that would take as long as expanding
+	// it), so a video built from `repeat` gets a different `vcat-cache` entry than the same video written out in full.
+	class ERepeatedList : public EObject {
+		public:
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			constexpr ERepeatedList(Spanned<const EObject&> element, size_t count)
+				: m_element(element)
+				, m_count(count) {}
+
+			constexpr Spanned<const EObject&> element() const {
+				return m_element;
+			}
+
+			constexpr size_t count() const {
+				return m_count;
+			}
+
+		private:
+			Spanned<const EObject&> m_element;
+			size_t                  m_count;
+	};
+	static_assert(!std::is_abstract<ERepeatedList>());
+
 	class EString : public EObject {
 		public:
 			void hash(vcat::Hasher& hasher) const;
@@ -90,6 +90,33 @@ namespace vcat::eval::error {
 		);
 	}
 
+	inline Diagnostic invalid_timestamp(std::string_view s, Span span) {
+		return Diagnostic(
+			std::format("Invalid timestamp `{}`; expected `[[hours:]minutes:]seconds[.fraction]`", s),
+			{
+				Hint::error("", span)
+			}
+		);
+	}
+
+	inline Diagnostic invalid_speed(std::string_view s, Span span) {
+		return Diagnostic(
+			std::format("Invalid speed `{}`; expected a positive number or fraction (ie `1.5` or `1/3`)", s),
+			{
+				Hint::error("", span)
+			}
+		);
+	}
+
+	inline Diagnostic zero_duration(Span span) {
+		return Diagnostic(
+			"The duration must be longer than 0",
+			{
+				Hint::error("", span)
+			}
+		);
+	}
+
 	inline Diagnostic unexpected_character_in_number(char c, Span span) {
 		return Diagnostic(
 			std::format("Unexpected character `{}` in number", c),
@@ -82,6 +82,24 @@ namespace vcat::eval {
 		if(expr.val == "repeat") {
 			return pool.add<BuiltinFunction<builtins::repeat, "repeat">>();
 		}
+		if(expr.val == "trim") {
+			return pool.add<BuiltinFunction<builtins::trim, "trim">>();
+		}
+		if(expr.val == "speed") {
+			return pool.add<BuiltinFunction<builtins::speed, "speed">>();
+		}
+		if(expr.val == "crossfade") {
+			return pool.add<BuiltinFunction<builtins::crossfade, "crossfade">>();
+		}
+		if(expr.val == "blank") {
+			return pool.add<BuiltinFunction<builtins::blank, "blank">>();
+		}
+		if(expr.val == "silence") {
+			return pool.add<BuiltinFunction<builtins::silence, "silence">>();
+		}
+		if(expr.val == "still") {
+			return pool.add<BuiltinFunction<builtins::still, "still">>();
+		}
 
 		throw error::undefined_variable(expr);
 	}
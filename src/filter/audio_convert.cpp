@@ -0,0 +1,388 @@
+#include "src/filter/audio_convert.hh"
+#include "src/constants.hh"
+#include "src/filter/error.hh"
+#include "src/filter/pool.hh"
+#include "src/filter/util.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <numbers>
+#include <optional>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/channel_layout.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/mathematics.h>
+	#include <libavutil/samplefmt.h>
+}
+
+// NOTE: the conversion loops below are intentionally kept simple (no intrinsics) so that the compiler
+// can vectorize them for whatever architecture vcat is being built for.
+
+namespace vcat::filter {
+	template<typename T> static inline float to_float(T sample);
+
+	template<> inline float to_float(uint8_t sample) {return (static_cast<int>(sample) - 128) * (1.0f / 128.0f);}
+	template<> inline float to_float(int16_t sample) {return sample * (1.0f / 32768.0f);}
+	template<> inline float to_float(int32_t sample) {return sample * (1.0f / 2147483648.0f);}
+	template<> inline float to_float(float   sample) {return sample;}
+	template<> inline float to_float(double  sample) {return static_cast<float>(sample);}
+
+	template<typename T> static inline T from_float(float sample);
+
+	template<> inline uint8_t from_float(float sample) {
+		return static_cast<uint8_t>(std::clamp<long>(std::lrintf(sample * 128.0f) + 128, 0, 255));
+	}
+
+	template<> inline int16_t from_float(float sample) {
+		return static_cast<int16_t>(std::clamp<long>(std::lrintf(sample * 32768.0f), -32768, 32767));
+	}
+
+	template<> inline int32_t from_float(float sample) {
+		return static_cast<int32_t>(std::clamp<long long>(
+			std::llrint(static_cast<double>(sample) * 2147483648.0),
+			std::numeric_limits<int32_t>::min(),
+			std::numeric_limits<int32_t>::max()
+		));
+	}
+
+	template<> inline float  from_float(float sample) {return sample;}
+	template<> inline double from_float(float sample) {return sample;}
+
+	// Copies one channel of samples (ie (de)interleaves audio)
+	template<typename T>
+	static void copy_channel(const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, int num_samples) {
+		const T *__restrict in  = reinterpret_cast<const T *>(src);
+		T       *__restrict out = reinterpret_cast<T *>(dst);
+
+		if(src_stride == 1 && dst_stride == 1) {
+			std::copy_n(in, num_samples, out);
+			return;
+		}
+
+		for(int i = 0; i < num_samples; i++) {
+			out[i * dst_stride] = in[i * src_stride];
+		}
+	}
+
+	template<typename T>
+	static void read_channel(const uint8_t *src, size_t src_stride, float *__restrict dst, int num_samples) {
+		const T *__restrict in = reinterpret_cast<const T *>(src);
+
+		for(int i = 0; i < num_samples; i++) {
+			dst[i] = to_float(in[i * src_stride]);
+		}
+	}
+
+	template<typename T>
+	static void write_channel(const float *__restrict src, uint8_t *dst, size_t dst_stride, int num_samples) {
+		T *__restrict out = reinterpret_cast<T *>(dst);
+
+		for(int i = 0; i < num_samples; i++) {
+			out[i * dst_stride] = from_float<T>(src[i]);
+		}
+	}
+
+	static void copy_samples(AVSampleFormat fmt, const uint8_t *src, size_t src_stride, uint8_t *dst, size_t dst_stride, int num_samples) {
+		switch(av_get_bytes_per_sample(fmt)) {
+			case 1: return copy_channel<uint8_t >(src, src_stride, dst, dst_stride, num_samples);
+			case 2: return copy_channel<uint16_t>(src, src_stride, dst, dst_stride, num_samples);
+			case 4: return copy_channel<uint32_t>(src, src_stride, dst, dst_stride, num_samples);
+			case 8: return copy_channel<uint64_t>(src, src_stride, dst, dst_stride, num_samples);
+		}
+
+		std::abort();
+	}
+
+	static void read_samples(AVSampleFormat fmt, const uint8_t *src, size_t src_stride, float *dst, int num_samples) {
+		switch(av_get_packed_sample_fmt(fmt)) {
+			case AV_SAMPLE_FMT_U8:  return read_channel<uint8_t>(src, src_stride, dst, num_samples);
+			case AV_SAMPLE_FMT_S16: return read_channel<int16_t>(src, src_stride, dst, num_samples);
+			case AV_SAMPLE_FMT_S32: return read_channel<int32_t>(src, src_stride, dst, num_samples);
+			case AV_SAMPLE_FMT_FLT: return read_channel<float  >(src, src_stride, dst, num_samples);
+			case AV_SAMPLE_FMT_DBL: return read_channel<double >(src, src_stride, dst, num_samples);
+			default: break;
+		}
+
+		std::abort();
+	}
+
+	static void write_samples(AVSampleFormat fmt, const float *src, uint8_t *dst, size_t dst_stride, int num_samples) {
+		switch(av_get_packed_sample_fmt(fmt)) {
+			case AV_SAMPLE_FMT_U8:  return write_channel<uint8_t>(src, dst, dst_stride, num_samples);
+			case AV_SAMPLE_FMT_S16: return write_channel<int16_t>(src, dst, dst_stride, num_samples);
+			case AV_SAMPLE_FMT_S32: return write_channel<int32_t>(src, dst, dst_stride, num_samples);
+			case AV_SAMPLE_FMT_FLT: return write_channel<float  >(src, dst, dst_stride, num_samples);
+			case AV_SAMPLE_FMT_DBL: return write_channel<double >(src, dst, dst_stride, num_samples);
+			default: break;
+		}
+
+		std::abort();
+	}
+
+	static bool is_supported_format(AVSampleFormat fmt) {
+		switch(av_get_packed_sample_fmt(fmt)) {
+			case AV_SAMPLE_FMT_U8:
+			case AV_SAMPLE_FMT_S16:
+			case AV_SAMPLE_FMT_S32:
+			case AV_SAMPLE_FMT_FLT:
+			case AV_SAMPLE_FMT_DBL:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Creates a simple up/downmixing matrix (see `AudioConvert::m_matrix`).
+	//
+	// Returns `std::nullopt` if the layouts contain channels that cannot be mapped without `aresample`.
+	static std::optional<std::vector<float>> mix_matrix(uint64_t in_layout, uint64_t out_layout) {
+		constexpr float MINUS_3DB = std::numbers::sqrt2_v<float> / 2.0f;
+
+		constexpr uint64_t LEFT   = AV_CH_FRONT_LEFT | AV_CH_BACK_LEFT | AV_CH_SIDE_LEFT;
+		constexpr uint64_t RIGHT  = AV_CH_FRONT_RIGHT | AV_CH_BACK_RIGHT | AV_CH_SIDE_RIGHT;
+		constexpr uint64_t CENTER = AV_CH_FRONT_CENTER | AV_CH_BACK_CENTER;
+
+		const int in_channels  = std::popcount(in_layout);
+		const int out_channels = std::popcount(out_layout);
+
+		if(in_channels == 0 || out_channels == 0) {
+			return std::nullopt;
+		}
+
+		std::vector<float> matrix(static_cast<size_t>(in_channels * out_channels), 0.0f);
+
+		// Channels in a native layout are ordered by their bit
+		auto index = [](uint64_t layout, uint64_t channel) {return std::popcount(layout & (channel - 1));};
+		auto add   = [&](uint64_t out_channel, uint64_t in_channel, float coefficient) {
+			matrix[index(out_layout, out_channel) * in_channels + index(in_layout, in_channel)] += coefficient;
+		};
+
+		const bool out_has_stereo = (out_layout & AV_CH_LAYOUT_STEREO) == AV_CH_LAYOUT_STEREO;
+		const bool in_has_stereo  = (in_layout  & AV_CH_LAYOUT_STEREO) != 0;
+
+		for(uint64_t remaining = in_layout; remaining != 0; remaining &= remaining - 1) {
+			const uint64_t channel = remaining & (~remaining + 1);
+
+			if(out_layout & channel) {
+				add(channel, channel, 1.0f);
+			} else if(channel == AV_CH_LOW_FREQUENCY) {
+				continue; // Dropped (this is also what `aresample` does by default)
+			} else if((channel & LEFT) && (out_layout & AV_CH_FRONT_LEFT)) {
+				add(AV_CH_FRONT_LEFT, channel, MINUS_3DB);
+			} else if((channel & RIGHT) && (out_layout & AV_CH_FRONT_RIGHT)) {
+				add(AV_CH_FRONT_RIGHT, channel, MINUS_3DB);
+			} else if((channel & (LEFT | RIGHT)) && (out_layout & AV_CH_FRONT_CENTER)) {
+				add(AV_CH_FRONT_CENTER, channel, 0.5f);
+			} else if((channel & CENTER) && out_has_stereo) {
+				// A lone center channel (ie mono audio) is copied to both sides
+				const float coefficient = in_has_stereo ? MINUS_3DB : 1.0f;
+
+				add(AV_CH_FRONT_LEFT,  channel, coefficient);
+				add(AV_CH_FRONT_RIGHT, channel, coefficient);
+			} else if((channel & CENTER) && (out_layout & AV_CH_FRONT_CENTER)) {
+				add(AV_CH_FRONT_CENTER, channel, MINUS_3DB);
+			} else {
+				return std::nullopt;
+			}
+		}
+
+		// Prevent clipping
+		for(int o = 0; o < out_channels; o++) {
+			float *row = &matrix[o * in_channels];
+			float sum = 0.0f;
+
+			for(int i = 0; i < in_channels; i++) {
+				sum += row[i];
+			}
+
+			if(sum > 1.0f) {
+				for(int i = 0; i < in_channels; i++) {
+					row[i] /= sum;
+				}
+			}
+		}
+
+		return matrix;
+	}
+
+	bool AudioConvert::can_convert(const util::AFrameInfo& info, const AudioParameters& output) {
+		return
+			info.sample_rate == output.sample_rate                                              &&
+			is_supported_format(info.sample_fmt)                                                &&
+			is_supported_format(util::SampleFormat_get_AVSampleFormat(output.sample_format))    &&
+			mix_matrix(info.channel_layout, output.channel_layout).has_value();
+	}
+
+	AudioConvert::AudioConvert(Span span, std::unique_ptr<FrameSource>&& src, const util::AFrameInfo& info, const AudioParameters& output)
+		: m_span(span)
+		, m_src(std::move(src))
+		, m_in_fmt(info.sample_fmt)
+		, m_out_fmt(util::SampleFormat_get_AVSampleFormat(output.sample_format))
+		, m_in_channels(std::popcount(info.channel_layout))
+		, m_out_channels(std::popcount(output.channel_layout))
+		, m_sample_rate(output.sample_rate)
+		, m_out_layout(output.channel_layout)
+		, m_scratch(2 * constants::SAMPLES_PER_FRAME)
+		, m_in(pool::alloc_frame())
+		, m_in_offset(0)
+		, m_start_pts(AV_NOPTS_VALUE)
+		, m_samples_out(0)
+		, m_eof(false)
+	{
+		assert(can_convert(info, output));
+
+		error::handle_ffmpeg_error(m_span, m_in ? 0 : AVERROR(ENOMEM));
+
+		m_matrix = *mix_matrix(info.channel_layout, output.channel_layout);
+
+		for(int o = 0; o < m_out_channels; o++) {
+			const float *row = &m_matrix[o * m_in_channels];
+			int route = -1;
+
+			for(int i = 0; i < m_in_channels; i++) {
+				if(row[i] == 0.0f) {
+					continue;
+				}
+
+				route = (route == -1 && row[i] == 1.0f) ? i : -2;
+			}
+
+			m_routes.push_back(std::max(route, -1));
+		}
+	}
+
+	bool AudioConvert::next_frame(AVFrame **p_frame) {
+		AVFrame *const frame = *p_frame;
+
+		if(m_eof) {
+			return false;
+		}
+
+		frame->format      = m_out_fmt;
+		frame->nb_samples  = constants::SAMPLES_PER_FRAME;
+		frame->sample_rate = m_sample_rate;
+
+		error::handle_ffmpeg_error(m_span,
+			av_channel_layout_from_mask(&frame->ch_layout, m_out_layout)
+		);
+
+		error::handle_ffmpeg_error(m_span,
+			pool::get_buffer(frame)
+		);
+
+		int filled = 0;
+
+		while(filled < static_cast<int>(constants::SAMPLES_PER_FRAME)) {
+			if(m_in_offset >= m_in->nb_samples) {
+				av_frame_unref(m_in);
+				m_in_offset = 0;
+
+				if(!m_src->next_frame(&m_in)) {
+					m_eof = true;
+					break;
+				}
+
+				assert(m_in->format == m_in_fmt);
+				assert(m_in->ch_layout.nb_channels == m_in_channels);
+
+				if(m_start_pts == AV_NOPTS_VALUE) {
+					m_start_pts = m_in->pts;
+				}
+
+				continue;
+			}
+
+			const int num_samples = std::min(m_in->nb_samples - m_in_offset, static_cast<int>(constants::SAMPLES_PER_FRAME) - filled);
+
+			convert(frame, filled, num_samples);
+
+			m_in_offset += num_samples;
+			filled      += num_samples;
+		}
+
+		if(filled == 0) {
+			av_frame_unref(frame);
+			return false;
+		}
+
+		const AVRational sample_dur = {1, m_sample_rate};
+		const int64_t    end_pts    = m_start_pts + av_rescale_q(m_samples_out + filled, sample_dur, constants::TIMEBASE);
+
+		frame->nb_samples = filled;
+		frame->pts        = m_start_pts + av_rescale_q(m_samples_out, sample_dur, constants::TIMEBASE);
+		frame->duration   = end_pts - frame->pts;
+
+		m_samples_out += filled;
+
+		return true;
+	}
+
+	void AudioConvert::convert(AVFrame *output, int out_offset, int num_samples) {
+		const bool in_planar  = av_sample_fmt_is_planar(m_in_fmt);
+		const bool out_planar = av_sample_fmt_is_planar(m_out_fmt);
+		const bool same_type  = av_get_packed_sample_fmt(m_in_fmt) == av_get_packed_sample_fmt(m_out_fmt);
+
+		const size_t in_bps  = av_get_bytes_per_sample(m_in_fmt);
+		const size_t out_bps = av_get_bytes_per_sample(m_out_fmt);
+
+		const size_t in_stride  = in_planar  ? 1 : m_in_channels;
+		const size_t out_stride = out_planar ? 1 : m_out_channels;
+
+		auto in_channel = [&](int c) -> const uint8_t * {
+			return in_planar
+				? m_in->extended_data[c] + m_in_offset * in_bps
+				: m_in->extended_data[0] + (m_in_offset * in_stride + c) * in_bps;
+		};
+
+		auto out_channel = [&](int c) -> uint8_t * {
+			return out_planar
+				? output->extended_data[c] + out_offset * out_bps
+				: output->extended_data[0] + (out_offset * out_stride + c) * out_bps;
+		};
+
+		float *const mix = &m_scratch[0];
+		float *const tmp = &m_scratch[constants::SAMPLES_PER_FRAME];
+
+		for(int o = 0; o < m_out_channels; o++) {
+			const int route = m_routes[o];
+
+			if(route >= 0 && same_type) {
+				copy_samples(m_out_fmt, in_channel(route), in_stride, out_channel(o), out_stride, num_samples);
+				continue;
+			}
+
+			if(route >= 0) {
+				read_samples(m_in_fmt, in_channel(route), in_stride, mix, num_samples);
+			} else {
+				std::fill_n(mix, num_samples, 0.0f);
+
+				for(int i = 0; i < m_in_channels; i++) {
+					const float coefficient = m_matrix[o * m_in_channels + i];
+
+					if(coefficient == 0.0f) {
+						continue;
+					}
+
+					read_samples(m_in_fmt, in_channel(i), in_stride, tmp, num_samples);
+
+					for(int j = 0; j < num_samples; j++) {
+						mix[j] += coefficient * tmp[j];
+					}
+				}
+			}
+
+			write_samples(m_out_fmt, mix, out_channel(o), out_stride, num_samples);
+		}
+	}
+
+	AudioConvert::~AudioConvert() {
+		pool::free_frame(&m_in);
+	}
+}
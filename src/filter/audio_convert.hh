@@ -0,0 +1,65 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/params.hh"
+#include "src/filter/util.hh"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/frame.h>
+	#include <libavutil/samplefmt.h>
+}
+
+namespace vcat::filter {
+	// Converts the sample format and channel layout of audio without going through `aresample`.
+	//
+	// This can only be used when no sample rate conversion is required (see `AudioConvert::can_convert`).
+	// Like the output of an audio filtergraph, the output frames contain `constants::SAMPLES_PER_FRAME`
+	// samples (except for the last one).
+	class AudioConvert : public FrameSource {
+		public:
+			AudioConvert() = delete;
+			AudioConvert(AudioConvert&) = delete;
+
+			// NOTE: `AudioConvert::can_convert` must return `true` for `info` and `output`
+			AudioConvert(Span span, std::unique_ptr<FrameSource>&& src, const util::AFrameInfo& info, const AudioParameters& output);
+
+			static bool can_convert(const util::AFrameInfo& info, const AudioParameters& output);
+
+			bool next_frame(AVFrame **frame);
+			~AudioConvert();
+
+		private:
+			// Converts `num_samples` samples starting at `m_in_offset` into `output` starting at `out_offset`
+			void convert(AVFrame *output, int out_offset, int num_samples);
+
+			Span                         m_span;
+			std::unique_ptr<FrameSource> m_src;
+
+			AVSampleFormat               m_in_fmt;
+			AVSampleFormat               m_out_fmt;
+			int                          m_in_channels;
+			int                          m_out_channels;
+			int                          m_sample_rate;
+			uint64_t                     m_out_layout;
+
+			// Row-major `m_out_channels` by `m_in_channels` mixing matrix
+			std::vector<float>           m_matrix;
+
+			// For every output channel, the input channel that it is a copy of (or `-1` if it must be mixed)
+			std::vector<int>             m_routes;
+			std::vector<float>           m_scratch;
+
+			AVFrame                     *m_in;
+			int                          m_in_offset;
+			int64_t                      m_start_pts;
+			int64_t                      m_samples_out;
+			bool                         m_eof;
+	};
+
+	static_assert(!std::is_abstract<AudioConvert>());
+}
@@ -0,0 +1,221 @@
+#include "src/filter/audio_fit.hh"
+#include "src/constants.hh"
+#include "src/filter/error.hh"
+#include "src/filter/pool.hh"
+#include "src/filter/util.hh"
+#include <algorithm>
+
+extern "C" {
+	#include <libavcodec/avcodec.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/channel_layout.h>
+	#include <libavutil/error.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/mathematics.h>
+	#include <libavutil/samplefmt.h>
+}
+
+namespace vcat::filter {
+	// The encoder may hold on to a few frames before it outputs a packet
+	static constexpr int MAX_SILENT_FRAMES = 8;
+
+	// Encodes a frame of silence with the audio encoder
+	static AVPacket *encode_silence(Span span, const AudioParameters& output) {
+		AVCodecContext *encoder = util::create_audio_encoder(span, output);
+
+		AVFrame *frame = pool::alloc_frame();
+		AVPacket *packet = pool::alloc_packet();
+
+		error::handle_ffmpeg_error(span, frame && packet ? 0 : AVERROR(ENOMEM));
+
+		frame->format      = encoder->sample_fmt;
+		frame->sample_rate = encoder->sample_rate;
+		frame->nb_samples  = constants::SAMPLES_PER_FRAME;
+
+		error::handle_ffmpeg_error(span,
+			av_channel_layout_copy(&frame->ch_layout, &encoder->ch_layout)
+		);
+
+		error::handle_ffmpeg_error(span,
+			av_frame_get_buffer(frame, 0)
+		);
+
+		av_samples_set_silence(frame->extended_data, 0, frame->nb_samples, frame->ch_layout.nb_channels, encoder->sample_fmt);
+
+		const AVRational sample_tb = AVRational {1, encoder->sample_rate};
+
+		for(int i = 0; i < MAX_SILENT_FRAMES; i++) {
+			frame->pts = av_rescale_q(i * frame->nb_samples, sample_tb, encoder->time_base);
+
+			error::handle_ffmpeg_error(span,
+				avcodec_send_frame(encoder, frame)
+			);
+
+			int res = avcodec_receive_packet(encoder, packet);
+
+			if(res == 0) {
+				break;
+			} else if(res != AVERROR(EAGAIN)) {
+				error::handle_ffmpeg_error(span, res);
+			}
+		}
+
+		error::handle_ffmpeg_error(span, packet->size > 0 ? 0 : AVERROR_UNKNOWN);
+
+		// The copies get their own timestamps and side data
+		av_packet_free_side_data(packet);
+
+		pool::free_frame(&frame);
+		avcodec_free_context(&encoder);
+
+		return packet;
+	}
+
+	AudioFitPktSource::AudioFitPktSource(Span span, std::unique_ptr<PacketSource>&& src, int64_t end, const AudioParameters& output)
+		: m_span(span)
+		, m_src(std::move(src))
+		, m_output(output)
+		, m_sample_tb(AVRational {1, output.sample_rate})
+		, m_end(end)
+		, m_pad_samples(0)
+		, m_silence(nullptr)
+		, m_src_eof(false)
+	{
+		const TsInfo src_end = m_src->pts_end_info();
+		m_pad_start = src_end.ts + src_end.duration;
+	}
+
+	bool AudioFitPktSource::next_pkt(AVPacket **p_packet) {
+		AVPacket *const packet = *p_packet;
+
+		if(m_src_eof) {
+			return next_silence(packet);
+		}
+
+		if(!m_src->next_pkt(p_packet)) {
+			m_src_eof = true;
+			return next_silence(packet);
+		}
+
+		// A frame that is mostly past the end is left out (along with the rest of the stream)
+		if(packet->pts + packet->duration / 2 >= m_end) {
+			av_packet_unref(packet);
+
+			m_src_eof = true;
+			m_pad_start = m_end;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	bool AudioFitPktSource::next_silence(AVPacket *packet) {
+		const int64_t pts = m_pad_start + av_rescale_q(m_pad_samples, m_sample_tb, constants::TIMEBASE);
+		const int64_t half_frame = av_rescale_q(constants::SAMPLES_PER_FRAME / 2, m_sample_tb, constants::TIMEBASE);
+
+		if(pts + half_frame >= m_end) {
+			return false;
+		}
+
+		if(!m_silence) {
+			m_silence = encode_silence(m_span, m_output);
+		}
+
+		error::handle_ffmpeg_error(m_span,
+			av_packet_ref(packet, m_silence)
+		);
+
+		m_pad_samples += constants::SAMPLES_PER_FRAME;
+
+		const int64_t next_pts = m_pad_start + av_rescale_q(m_pad_samples, m_sample_tb, constants::TIMEBASE);
+
+		packet->pts          = pts;
+		packet->dts          = pts;
+		packet->duration     = next_pts - pts;
+		packet->stream_index = 0;
+		packet->flags       |= AV_PKT_FLAG_KEY;
+
+		return true;
+	}
+
+	bool AudioFitPktSource::seek(int64_t ts) {
+		if(ts < m_pad_start) {
+			if(!m_src->seek(ts)) {
+				return false;
+			}
+
+			m_src_eof = false;
+			m_pad_samples = 0;
+
+			return true;
+		}
+
+		// Every silent packet is a keyframe
+		const int64_t frame_size = constants::SAMPLES_PER_FRAME;
+		const int64_t samples = av_rescale_q(ts - m_pad_start, constants::TIMEBASE, m_sample_tb);
+
+		m_src_eof = true;
+		m_pad_samples = samples / frame_size * frame_size;
+
+		return true;
+	}
+
+	const AVCodecParameters *AudioFitPktSource::video_codec() {
+		return m_src->video_codec();
+	}
+
+	int64_t AudioFitPktSource::first_pkt_duration() const {
+		return m_src->first_pkt_duration();
+	}
+
+	size_t AudioFitPktSource::dts_shift() const {
+		return m_src->dts_shift();
+	}
+
+	TsInfo AudioFitPktSource::pts_end_info() const {
+		const TsInfo src_end = m_src->pts_end_info();
+		const int64_t src_end_ts = src_end.ts + src_end.duration;
+
+		if(src_end_ts >= m_end) {
+			if(src_end.ts < m_end) {
+				return TsInfo {.ts = src_end.ts, .duration = m_end - src_end.ts};
+			}
+
+			// This isn't exactly the last packet, but it ends in the same place
+			const int64_t duration = std::min(src_end.duration, m_end);
+			return TsInfo {.ts = m_end - duration, .duration = duration};
+		}
+
+		// The last silent packet
+		const int64_t num_samples = av_rescale_q_rnd(m_end - src_end_ts, constants::TIMEBASE, m_sample_tb, AV_ROUND_UP);
+		const int64_t frame_size  = constants::SAMPLES_PER_FRAME;
+		const int64_t last_start  = (num_samples - 1) / frame_size * frame_size;
+		const int64_t ts          = src_end_ts + av_rescale_q(last_start, m_sample_tb, constants::TIMEBASE);
+
+		return TsInfo {.ts = ts, .duration = m_end - ts};
+	}
+
+	AudioFitPktSource::~AudioFitPktSource() {
+		pool::free_packet(&m_silence);
+	}
+
+	bool AudioSplicer::place(AVPacket *packet) {
+		if(!m_end) {
+			m_end = packet->pts + packet->duration;
+			return true;
+		}
+
+		const int64_t lateness = *m_end - packet->pts;
+
+		if(lateness * 2 > packet->duration) {
+			return false;
+		}
+
+		packet->pts = *m_end;
+		packet->dts = *m_end;
+		*m_end += packet->duration;
+
+		return true;
+	}
+}
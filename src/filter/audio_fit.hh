@@ -0,0 +1,80 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/params.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+extern "C" {
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/rational.h>
+}
+
+namespace vcat::filter {
+	// Trims or pads an AAC stream so that it ends at `end` (in `constants::TIMEBASE`) without decoding it.
+	//
+	// Only whole frames are kept because MP4 can't cut a frame in the middle of a track (the muxer ignores
+	// `AV_PKT_DATA_SKIP_SAMPLES` there), so the stream ends on the frame boundary nearest to `end`. If the stream is
+	// too short, it is padded with references to a single silent AAC packet. `pts_end_info` still reports `end`, so
+	// that the next clip starts where the video does (see `AudioSplicer`).
+	//
+	// NOTE: the source must be AAC-LC with the parameters of `output` (see `util::codec_matches_output`)
+	class AudioFitPktSource : public PacketSource {
+		public:
+			AudioFitPktSource() = delete;
+			AudioFitPktSource(AudioFitPktSource&) = delete;
+
+			AudioFitPktSource(Span span, std::unique_ptr<PacketSource>&& src, int64_t end, const AudioParameters& output);
+
+			bool next_pkt(AVPacket **p_packet);
+			const AVCodecParameters *video_codec();
+			int64_t first_pkt_duration() const;
+			size_t  dts_shift() const;
+			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+			~AudioFitPktSource();
+
+		private:
+			// Gets the next silent packet (or `false` if `m_end` has been reached)
+			bool next_silence(AVPacket *packet);
+
+			Span                          m_span;
+			std::unique_ptr<PacketSource> m_src;
+			AudioParameters               m_output;
+			AVRational                    m_sample_tb; //< The duration of one sample
+			int64_t                       m_end;
+			int64_t                       m_pad_start; //< The pts of the first silent packet
+			int64_t                       m_pad_samples;
+			AVPacket                     *m_silence;   //< Encoded lazily
+			bool                          m_src_eof;
+	};
+
+	static_assert(!std::is_abstract<AudioFitPktSource>());
+
+	// Lays the AAC frames of consecutive clips end to end.
+	//
+	// Whole frames rarely add up to the length of a clip, so the rounding is carried over into the next clip: a
+	// frame is dropped if the audio would otherwise be more than half a frame behind the timeline. This keeps the
+	// audio within half a frame of the video however many clips there are, and it also drops the encoder priming of
+	// every clip but the first (which the muxer hides with an edit list).
+	class AudioSplicer {
+		public:
+			constexpr AudioSplicer() : m_end() {}
+
+			// Moves an audio packet (with its timestamps on the timeline) right after the previous one. Returns
+			// `false` if it should be dropped instead.
+			bool place(AVPacket *packet);
+
+			// Starts over (ie after seeking), so that the next packet keeps its timestamps
+			inline void reset() {
+				m_end.reset();
+			}
+
+		private:
+			std::optional<int64_t> m_end; //< Where the last packet ended
+	};
+}
@@ -0,0 +1,102 @@
+#include "src/filter/blank.hh"
+#include "src/constants.hh"
+#include "src/filter/audio_fit.hh"
+#include "src/filter/still.hh"
+#include "src/util.hh"
+#include <format>
+#include <sstream>
+
+namespace vcat::filter {
+	Blank::Blank(int64_t duration) : m_duration(duration) {}
+
+	void Blank::hash(Hasher& hasher) const {
+		hasher.add("_blank_");
+		const size_t start = hasher.pos();
+
+		hasher.add(m_duration);
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Blank::to_string() const {
+		return std::format("Blank({})", av_q2d(constants::TIMEBASE) * m_duration);
+	}
+
+	std::string Blank::type_name() const {
+		return "Blank";
+	}
+
+	std::optional<int64_t> Blank::duration(FilterContext&, Span) const {
+		return m_duration;
+	}
+
+	std::unique_ptr<PacketSource> Blank::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Video) {
+			return repeat_gop(ctx, span, m_duration, [&](int64_t duration) {
+				return encode(ctx, span, Blank(duration), type);
+			});
+		}
+
+		const int64_t unit = gop_length(ctx.vparams);
+
+		if(m_duration <= unit) {
+			return encode(ctx, span, *this, type);
+		}
+
+		// The rest of the audio is padded with references to a single silent packet
+		return std::make_unique<AudioFitPktSource>(span, encode(ctx, span, Blank(unit), type), m_duration, ctx.aparams);
+	}
+
+	std::unique_ptr<FrameSource> Blank::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		return std::make_unique<StillFrameSource>(span, ctx, type, m_duration);
+	}
+
+	Silence::Silence(Spanned<const VFilter&> video) : m_video(video) {}
+
+	void Silence::hash(Hasher& hasher) const {
+		hasher.add("_silence_");
+		const size_t start = hasher.pos();
+
+		m_video->hash(hasher);
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Silence::to_string() const {
+		std::stringstream s;
+
+		s << "Silence(\n"
+			<< indent(m_video->to_string())
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string Silence::type_name() const {
+		return "Silence";
+	}
+
+	void Silence::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		m_video->count_codecs(counts);
+	}
+
+	std::optional<int64_t> Silence::duration(FilterContext& ctx, Span) const {
+		return m_video->duration(ctx, m_video.span);
+	}
+
+	std::unique_ptr<PacketSource> Silence::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Video) {
+			return m_video->get_pkts(ctx, type, m_video.span);
+		}
+
+		return Blank(video_length(ctx, m_video)).get_pkts(ctx, type, span);
+	}
+
+	std::unique_ptr<FrameSource> Silence::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Video) {
+			return m_video->get_frames(ctx, type, m_video.span);
+		}
+
+		return std::make_unique<StillFrameSource>(span, ctx, type, video_length(ctx, m_video));
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace vcat::filter {
+	// Black video with silent audio.
+	//
+	// The packets of one GOP are encoded once (and cached), and longer blanks repeat them (see `repeat_gop`).
+	class Blank : public VFilter {
+		public:
+			Blank() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			// NOTE: `duration` must be positive
+			Blank(int64_t duration);
+
+		private:
+			int64_t m_duration;
+	};
+
+	static_assert(!std::is_abstract<Blank>());
+
+	// Replaces the audio of a video with silence (ie for videos that don't have an audio stream)
+	class Silence : public VFilter {
+		public:
+			Silence() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			Silence(Spanned<const VFilter&> video);
+
+		private:
+			Spanned<const VFilter&> m_video;
+	};
+
+	static_assert(!std::is_abstract<Silence>());
+}
@@ -0,0 +1,99 @@
+#include "src/filter/bsf.hh"
+#include "src/constants.hh"
+#include "src/filter/error.hh"
+
+extern "C" {
+	#include <libavcodec/bsf.h>
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/error.h>
+}
+
+namespace vcat::filter {
+	BsfPktSource::BsfPktSource(Span span, std::unique_ptr<PacketSource>&& src, const char *filters)
+		: m_span(span)
+		, m_src(std::move(src))
+		, m_bsf(nullptr)
+		, m_eof(false)
+	{
+		error::handle_ffmpeg_error(m_span,
+			av_bsf_list_parse_str(filters, &m_bsf)
+		);
+
+		error::handle_ffmpeg_error(m_span,
+			avcodec_parameters_copy(m_bsf->par_in, m_src->video_codec())
+		);
+
+		m_bsf->time_base_in = constants::TIMEBASE;
+
+		error::handle_ffmpeg_error(m_span,
+			av_bsf_init(m_bsf)
+		);
+	}
+
+	bool BsfPktSource::next_pkt(AVPacket **p_packet) {
+		for(;;) {
+			int res = av_bsf_receive_packet(m_bsf, *p_packet);
+
+			if(res == AVERROR_EOF) {
+				return false;
+			} else if(res != AVERROR(EAGAIN)) {
+				error::handle_ffmpeg_error(m_span, res);
+				return true;
+			}
+
+			if(m_eof) {
+				return false;
+			}
+
+			if(!m_src->next_pkt(p_packet)) {
+				m_eof = true;
+
+				error::handle_ffmpeg_error(m_span,
+					av_bsf_send_packet(m_bsf, nullptr)
+				);
+
+				continue;
+			}
+
+			error::handle_ffmpeg_error(m_span,
+				av_bsf_send_packet(m_bsf, *p_packet)
+			);
+		}
+	}
+
+	const AVCodecParameters *BsfPktSource::video_codec() {
+		return m_bsf->par_out;
+	}
+
+	int64_t BsfPktSource::first_pkt_duration() const {
+		return m_src->first_pkt_duration();
+	}
+
+	size_t BsfPktSource::dts_shift() const {
+		return m_src->dts_shift();
+	}
+
+	TsInfo BsfPktSource::pts_end_info() const {
+		return m_src->pts_end_info();
+	}
+
+	bool BsfPktSource::seek(int64_t ts) {
+		if(!m_src->seek(ts)) {
+			return false;
+		}
+
+		av_bsf_flush(m_bsf);
+		m_eof = false;
+
+		return true;
+	}
+
+	AVCodecParameters *BsfPktSource::codecpar() {
+		return m_bsf->par_out;
+	}
+
+	BsfPktSource::~BsfPktSource() {
+		av_bsf_free(&m_bsf);
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include <memory>
+
+extern "C" {
+	#include <libavcodec/bsf.h>
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+}
+
+namespace vcat::filter {
+	// Runs packets through a chain of bitstream filters (eg `h264_metadata=level=42`)
+	//
+	// The filters must not change the timing of the packets.
+	class BsfPktSource : public PacketSource {
+		public:
+			BsfPktSource() = delete;
+			BsfPktSource(BsfPktSource&) = delete;
+
+			// `filters` uses the syntax of `av_bsf_list_parse_str`
+			BsfPktSource(Span span, std::unique_ptr<PacketSource>&& src, const char *filters);
+
+			bool next_pkt(AVPacket **p_packet);
+			const AVCodecParameters *video_codec();
+			int64_t first_pkt_duration() const;
+			size_t  dts_shift() const;
+			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+			// The output codec parameters. Some filters don't update all of the fields that they change, so these
+			// may need to be patched by the caller.
+			AVCodecParameters *codecpar();
+
+			~BsfPktSource();
+
+		private:
+			Span                          m_span;
+			std::unique_ptr<PacketSource> m_src;
+			AVBSFContext                 *m_bsf;
+			bool                          m_eof;
+	};
+
+	static_assert(!std::is_abstract<BsfPktSource>());
+}
@@ -1,10 +1,18 @@
+#include <algorithm>
+#include <array>
 #include <format>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
 #include <sstream>
 
 #include "src/filter/concat.hh"
 #include "src/filter/error.hh"
 #include "src/filter/filter.hh"
+#include "src/filter/frame_cache.hh"
+#include "src/filter/h264.hh"
+#include "src/filter/repeat.hh"
 #include "src/filter/util.hh"
 #include "src/util.hh"
 
@@ -52,11 +60,48 @@ namespace vcat::filter {
 		return "Concat";
 	}
 
+	void Concat::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		for(const auto& video : m_videos) {
+			video->count_codecs(counts);
+		}
+	}
+
+	std::optional<int64_t> Concat::duration(FilterContext& ctx, Span) const {
+		int64_t total = 0;
+
+		for(const auto& video : m_videos) {
+			const std::optional<int64_t> duration = video->duration(ctx, video.span);
+
+			if(!duration) {
+				return std::nullopt;
+			}
+
+			total += *duration;
+		}
+
+		return total;
+	}
+
 	std::unique_ptr<FrameSource> Concat::get_frames(FilterContext& fctx, StreamType type, Span span) const {
-		std::vector<std::unique_ptr<FrameSource>> videos;
+		// Videos that are used more than once (here or elsewhere) are only decoded once
+		std::vector<frame_cache::Key> keys;
+		std::map<frame_cache::Key, size_t> occurrences;
 
 		for(const auto& video : m_videos) {
-			videos.push_back(video.val.get_frames(fctx, type, video.span));
+			keys.push_back(frame_cache::key(fctx, *video, type));
+			occurrences[keys.back()]++;
+		}
+
+		std::vector<std::unique_ptr<FrameSource>> videos;
+
+		for(size_t i = 0; i < m_videos.size(); i++) {
+			const Spanned<const VFilter&>& video = m_videos[i];
+
+			if(occurrences[keys[i]] > 1 || frame_cache::contains(keys[i])) {
+				videos.push_back(frame_cache::get_frames(fctx, video, type, keys[i]));
+			} else {
+				videos.push_back(video.val.get_frames(fctx, type, video.span));
+			}
 		}
 
 		if(videos.size() == 1) {
@@ -82,109 +127,358 @@ namespace vcat::filter {
 		return std::make_unique<FFMpegFilter>(span, std::move(videos), filter.c_str(), fctx, input_types, type);
 	}
 
-	class ConcatPktSource : public PacketSource {
-		public:
-			ConcatPktSource() = delete;
+	ConcatPktSource::ConcatPktSource(std::span<const Spanned<const VFilter&>> videos, FilterContext& ctx, StreamType type, Span span)
+		: m_span(span)
+		, m_type(type)
+		, m_codecpar(nullptr)
+		, m_dts_origin(0)
+		, m_pkt_idx(static_cast<size_t>(0) - 1)
+		, m_idx(0)
+		, m_started_idx(static_cast<size_t>(0) - 1)
+		, m_audio()
+	{
+		const bool allow_preroll = ctx.allow_preroll;
+
+		// Repeated videos (ie from `repeat`) are only opened once. Pre-roll can't be repeated, so the first video
+		// is kept on its own if it may have any.
+		const std::vector<Run> runs = find_runs(videos, allow_preroll);
+
+		for(const auto& run : runs) {
+			ctx.allow_preroll = allow_preroll && m_videos.empty();
+			m_videos.push_back(run.video->get_pkts(ctx, type, run.video.span));
+		}
+
+		ctx.allow_preroll = allow_preroll;
+
+		make_compatible(runs, ctx, type);
+
+		for(size_t i = 0; i < runs.size(); i++) {
+			if(runs[i].count > 1) {
+				m_videos[i] = std::make_unique<RepeatPktSource>(runs[i].video.span, std::move(m_videos[i]), runs[i].count);
+			}
+		}
+
+		if(type == StreamType::Video) {
+			calculate_parameter_sets();
+		} else {
+			m_parameter_sets.resize(m_videos.size());
+		}
+
+		calculate_ts_offsets();
+	}
+
+	ConcatPktSource::ConcatPktSource(Span span, std::vector<std::unique_ptr<PacketSource>>&& sources, StreamType type)
+		: m_span(span)
+		, m_type(type)
+		, m_videos(std::move(sources))
+		, m_codecpar(nullptr)
+		, m_dts_origin(0)
+		, m_pkt_idx(static_cast<size_t>(0) - 1)
+		, m_idx(0)
+		, m_started_idx(static_cast<size_t>(0) - 1)
+		, m_audio()
+	{
+		if(type == StreamType::Video) {
+			calculate_parameter_sets();
+		} else {
+			m_parameter_sets.resize(m_videos.size());
+		}
 
-			ConcatPktSource(std::span<const Spanned<const VFilter&>> videos, FilterContext& ctx,StreamType type, Span)
-				: m_pkt_idx(static_cast<size_t>(0) - 1)
-				, m_idx(0)
-			{
-				assert(type == StreamType::Video);
+		calculate_ts_offsets();
+	}
 
-				const AVCodecParameters *prev_param = nullptr;
+	ConcatPktSource::~ConcatPktSource() {
+		avcodec_parameters_free(&m_codecpar);
+	}
 
-				for(const auto& video : videos) {
-					m_videos.push_back(video->get_pkts(ctx, type, video.span));
-					const AVCodecParameters *cur_param = m_videos.back()->video_codec();
+	bool ConcatPktSource::next_pkt(AVPacket **p_packet) {
+		for(;;) {
+			if(m_idx >= m_videos.size()) {
+				return false;
+			}
 
-					if(prev_param) {
-						assert(util::codecs_are_compatible(cur_param, prev_param));
-					}
+			if(!m_videos[m_idx]->next_pkt(p_packet)) {
+				m_idx++;
+				continue;
+			}
 
-					prev_param = cur_param;
-				}
+			(*p_packet)->pts += m_pts_offsets[m_idx];
 
-				calculate_ts_offsets();
+			if(m_type == StreamType::Audio && !m_audio.place(*p_packet)) {
+				av_packet_unref(*p_packet);
+				continue;
 			}
 
-			bool next_pkt(AVPacket **p_packet) {
-				m_pkt_idx += 1;
+			break;
+		}
 
-				for(;;) {
-					if(m_idx >= m_videos.size()) {
-						return false;
-					}
+		m_pkt_idx += 1;
 
-					if(m_videos[m_idx]->next_pkt(p_packet)) {
-						break;
-					} else {
-						m_idx++;
-					}
-				}
+		AVPacket *packet = *p_packet;
 
-				AVPacket *packet = *p_packet;
+		// The first packet of a segment with different parameter sets carries them in-band
+		if(m_idx != m_started_idx) {
+			m_started_idx = m_idx;
 
-				packet->pts += m_pts_offsets[m_idx];
+			if(!m_parameter_sets[m_idx].empty()) {
+				h264::prepend_parameter_sets(m_span, packet, m_parameter_sets[m_idx]);
+			}
+		}
 
-				size_t idx = binary_search(std::span(m_prev_pts), packet->pts).second;
-				m_prev_pts.insert(m_prev_pts.begin() + idx, packet->pts);
+		// The generated dts count back from the first packet instead of from 0 because a pre-rolled first segment
+		// starts at a negative pts (see `FilterContext::allow_preroll`)
+		if(m_pkt_idx == 0) {
+			m_dts_origin = packet->pts;
+		}
 
-				if(m_pkt_idx >= m_dts_shift) {
-					packet->dts = m_prev_pts[m_pkt_idx - m_dts_shift];
-					return true;
-				}
+		size_t idx = binary_search(std::span(m_prev_pts), packet->pts).second;
+		m_prev_pts.insert(m_prev_pts.begin() + idx, packet->pts);
 
-				packet->dts = -first_pkt_duration() * static_cast<int64_t>(m_dts_shift - m_pkt_idx);
+		// Every packet uses the smallest pts that hasn't been used yet, so used ones are removed to keep this from
+		// growing with the length of the video
+		if(m_pkt_idx >= m_dts_shift) {
+			packet->dts = m_prev_pts.front();
+			m_prev_pts.erase(m_prev_pts.begin());
+			return true;
+		}
+
+		packet->dts = m_dts_origin - first_pkt_duration() * static_cast<int64_t>(m_dts_shift - m_pkt_idx);
+
+		return true;
+	}
 
-				return true;
+	bool ConcatPktSource::seek(int64_t ts) {
+		const size_t idx = std::max<ptrdiff_t>(std::ranges::upper_bound(m_pts_offsets, ts) - m_pts_offsets.begin() - 1, 0);
+
+		// The following segments are read from their start again
+		for(size_t i = idx + 1; i < m_videos.size(); i++) {
+			if(!m_videos[i]->seek(std::numeric_limits<int64_t>::min())) {
+				return false;
 			}
+		}
+
+		if(!m_videos[idx]->seek(ts - m_pts_offsets[idx])) {
+			return false;
+		}
+
+		m_idx         = idx;
+		m_started_idx = static_cast<size_t>(0) - 1;
+		m_pkt_idx     = static_cast<size_t>(0) - 1;
+		m_prev_pts.clear();
+		m_audio.reset();
+
+		return true;
+	}
 
-			const AVCodecParameters *video_codec() {
-				return m_videos[0]->video_codec();
+	const AVCodecParameters *ConcatPktSource::video_codec() {
+		if(m_codecpar) {
+			return m_codecpar;
+		}
+
+		return m_videos[0]->video_codec();
+	}
+
+	int64_t ConcatPktSource::first_pkt_duration() const {
+		return m_videos[0]->first_pkt_duration();
+	}
+
+	size_t ConcatPktSource::dts_shift() const {
+		return m_dts_shift;
+	}
+
+	TsInfo ConcatPktSource::pts_end_info() const {
+		TsInfo ts_info = m_videos.back()->pts_end_info();
+
+		ts_info.ts += m_pts_offsets.back();
+		return ts_info;
+	}
+
+	bool ConcatPktSource::spliceable(const AVCodecParameters *params1, const AVCodecParameters *params2) {
+		return
+			util::codecs_are_compatible(params1, params2)        ||
+			util::aac_configs_compatible(params1, params2)       ||
+			h264::can_switch_parameter_sets(params1, params2);
+	}
+
+	std::vector<ConcatPktSource::Run> ConcatPktSource::find_runs(std::span<const Spanned<const VFilter&>> videos, bool split_first) {
+		std::vector<Run> runs;
+		std::optional<std::array<uint8_t, Hasher::HASH_SIZE>> prev_hash;
+
+		for(size_t i = 0; i < videos.size(); i++) {
+			const bool same_object = !runs.empty() && &runs.back().video.val == &videos[i].val;
+
+			// Videos that are different objects may still be the same (ie the same file opened twice)
+			std::optional<std::array<uint8_t, Hasher::HASH_SIZE>> hash;
+
+			if(!same_object) {
+				Hasher hasher;
+				videos[i]->hash(hasher);
+				hash = hasher.into_bin();
 			}
 
-			int64_t first_pkt_duration() const {
-				return m_videos[0]->first_pkt_duration();
+			const bool can_group = i > 1 || (i == 1 && !split_first);
+
+			if(can_group && (same_object || hash == prev_hash)) {
+				runs.back().count++;
+				continue;
 			}
 
-			size_t dts_shift() const {
-				return m_dts_shift;
+			prev_hash = hash;
+			runs.push_back(Run {.video = videos[i], .count = 1});
+		}
+
+		return runs;
+	}
+
+	// Finds the segments whose parameter sets have to be inserted in-band. If there are any, `m_codecpar` is
+	// set to the output codec parameters.
+	void ConcatPktSource::calculate_parameter_sets() {
+		m_parameter_sets.resize(m_videos.size());
+
+		// The header is taken from a segment with the highest profile so that it covers every segment (and has
+		// the extension that the high profile needs)
+		size_t output_idx = 0;
+		int max_level = m_videos[0]->video_codec()->level;
+
+		for(size_t i = 1; i < m_videos.size(); i++) {
+			const AVCodecParameters *cur = m_videos[i]->video_codec();
+
+			max_level = std::max(max_level, cur->level);
+
+			if(!h264::profile_covers(m_videos[output_idx]->video_codec(), cur)) {
+				output_idx = i;
+			}
+		}
+
+		const AVCodecParameters *output = m_videos[output_idx]->video_codec();
+
+		for(size_t i = 0; i < m_videos.size(); i++) {
+			const AVCodecParameters *cur = m_videos[i]->video_codec();
+
+			// After a seek, the decoder only has the parameter sets of the output, so a segment needs its own
+			// whenever they differ from those, not just from the previous segment's
+			const bool same_as_prev = i == 0 || util::codecs_are_compatible(cur, m_videos[i - 1]->video_codec());
+
+			if(same_as_prev && util::codecs_are_compatible(cur, output)) {
+				continue;
 			}
 
-			TsInfo pts_end_info() const {
-				TsInfo ts_info = m_videos.back()->pts_end_info();
+			// Two segments that are spliceable with the same one aren't necessarily spliceable with each other, so
+			// nothing guarantees that the parameter sets can be read
+			std::optional<std::vector<uint8_t>> parameter_sets = h264::parameter_sets(cur);
 
-				ts_info.ts += m_pts_offsets.back();
-				return ts_info;
+			if(!parameter_sets) {
+				throw error::missing_parameter_sets(m_span);
 			}
 
-		private:
-			void calculate_ts_offsets() {
-				assert(!m_videos.empty());
+			m_parameter_sets[i] = std::move(*parameter_sets);
+		}
 
-				m_dts_shift = 0;
-				m_pts_offsets.reserve(m_videos.size());
+		if(std::ranges::all_of(m_parameter_sets, &std::vector<uint8_t>::empty)) {
+			return;
+		}
 
-				size_t pts_offset = 0;
+		m_codecpar = avcodec_parameters_alloc();
+		error::handle_ffmpeg_error(m_span, m_codecpar ? 0 : AVERROR(ENOMEM));
 
-				for(auto& vid : m_videos) {
-					m_dts_shift = std::max(m_dts_shift, vid->dts_shift());
+		error::handle_ffmpeg_error(m_span,
+			avcodec_parameters_copy(m_codecpar, output)
+		);
 
-					m_pts_offsets.push_back(pts_offset);
+		// `avc3` allows for parameter sets to be stored in-band. The level is raised so that it covers every
+		// segment, and only the constraint flags that every segment has are kept.
+		m_codecpar->codec_tag = MKTAG('a', 'v', 'c', '3');
+		m_codecpar->level = max_level;
+		m_codecpar->extradata[3] = static_cast<uint8_t>(max_level);
 
-					TsInfo pts_info = vid->pts_end_info();
-					pts_offset += pts_info.ts + pts_info.duration;
-				}
+		for(const auto& video : m_videos) {
+			m_codecpar->extradata[2] &= video->video_codec()->extradata[2];
+		}
+	}
+
+	// Re-encodes the videos that cannot be spliced with the rest.
+	//
+	// The videos are grouped by codec, and the group with the longest total duration is kept as-is. The rest are
+	// encoded so that they match that group (see `util::encoder_can_match`). If that isn't possible, the other
+	// group isn't re-encoded behind the user's back; an error is raised instead.
+	void ConcatPktSource::make_compatible(std::span<const Run> runs, FilterContext& ctx, StreamType type) {
+		std::vector<size_t>              group_of(m_videos.size());
+		std::vector<std::vector<size_t>> groups;
+		std::vector<int64_t>             group_duration;
+
+		for(size_t i = 0; i < m_videos.size(); i++) {
+			// `spliceable` isn't transitive, so a video has to be spliceable with every member of its group
+			size_t group = 0;
+
+			while(
+				group < groups.size() &&
+				!std::ranges::all_of(groups[group], [&](size_t member) {
+					return spliceable(m_videos[i]->video_codec(), m_videos[member]->video_codec());
+				})
+			) {
+				group++;
+			}
+
+			if(group == groups.size()) {
+				groups.emplace_back();
+				group_duration.push_back(0);
+			}
+
+			const TsInfo end = m_videos[i]->pts_end_info();
+
+			group_of[i] = group;
+			groups[group].push_back(i);
+			group_duration[group] += (end.ts + end.duration) * static_cast<int64_t>(runs[i].count);
+		}
+
+		if(groups.size() <= 1) {
+			return;
+		}
+
+		const size_t reference = std::ranges::max_element(group_duration) - group_duration.begin();
+		const size_t reference_idx = groups[reference][0];
+		const AVCodecParameters *reference_codec = m_videos[reference_idx]->video_codec();
+
+		const bool can_match = type == StreamType::Audio || util::encoder_can_match(reference_codec, ctx.vparams);
+
+		for(size_t i = 0; i < m_videos.size(); i++) {
+			if(group_of[i] == reference) {
+				continue;
+			}
+
+			if(!can_match) {
+				throw error::cannot_match_video(runs[i].video.span, runs[reference_idx].video.span);
 			}
 
-			std::vector<std::unique_ptr<PacketSource>> m_videos;
-			size_t                                     m_dts_shift;
-			std::vector<int64_t>                       m_pts_offsets; //< How much the pts of every packet in the videos should be offset
-			std::vector<int64_t>                       m_prev_pts;
-			size_t                                     m_pkt_idx;
-			size_t                                     m_idx;
-	};
+			m_videos[i] = encode(ctx, runs[i].video.span, runs[i].video.val, type, type == StreamType::Video ? reference_codec : nullptr);
+
+			const bool joins = std::ranges::all_of(groups[reference], [&](size_t member) {
+				return spliceable(m_videos[i]->video_codec(), m_videos[member]->video_codec());
+			});
+
+			if(!joins) {
+				throw error::cannot_match_video(runs[i].video.span, runs[reference_idx].video.span);
+			}
+		}
+	}
+
+	void ConcatPktSource::calculate_ts_offsets() {
+		assert(!m_videos.empty());
+
+		m_dts_shift = 0;
+		m_pts_offsets.reserve(m_videos.size());
+
+		size_t pts_offset = 0;
+
+		for(auto& vid : m_videos) {
+			m_dts_shift = std::max(m_dts_shift, vid->dts_shift());
+
+			m_pts_offsets.push_back(pts_offset);
+
+			TsInfo pts_info = vid->pts_end_info();
+			pts_offset += pts_info.ts + pts_info.duration;
+		}
+	}
 
 	std::unique_ptr<PacketSource> Concat::get_pkts(FilterContext& ctx, StreamType type, Span s) const {
 		return std::make_unique<ConcatPktSource>(m_videos, ctx, type, s);
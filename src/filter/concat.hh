@@ -1,6 +1,17 @@
 #pragma once
 
+#include "src/filter/audio_fit.hh"
 #include "src/filter/filter.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+extern "C" {
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+}
 
 namespace vcat::filter {
 	class Concat : public VFilter {
@@ -12,6 +23,12 @@ namespace vcat::filter {
 
 			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
 			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			inline std::span<const Spanned<const VFilter&>> videos() const {
+				return m_videos;
+			}
 
 			Concat(std::vector<Spanned<const VFilter&>> videos, Span s);
 		private:
@@ -19,4 +36,60 @@ namespace vcat::filter {
 	};
 
 	static_assert(!std::is_abstract<Concat>());
+
+	// Joins packet streams one after another without re-encoding them
+	class ConcatPktSource : public PacketSource {
+		public:
+			ConcatPktSource() = delete;
+			ConcatPktSource(ConcatPktSource&) = delete;
+
+			// Re-encodes the videos that can't be spliced with the rest
+			ConcatPktSource(std::span<const Spanned<const VFilter&>> videos, FilterContext& ctx, StreamType type, Span span);
+
+			// NOTE: every source must be `spliceable` with the first one
+			ConcatPktSource(Span span, std::vector<std::unique_ptr<PacketSource>>&& sources, StreamType type);
+
+			// Checks if packets with the given codec parameters can follow each other in the same stream
+			static bool spliceable(const AVCodecParameters *params1, const AVCodecParameters *params2);
+
+			bool next_pkt(AVPacket **p_packet);
+			const AVCodecParameters *video_codec();
+			int64_t first_pkt_duration() const;
+			size_t  dts_shift() const;
+			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+			~ConcatPktSource();
+
+		private:
+			// A video that is repeated `count` times in a row
+			struct Run {
+				Spanned<const VFilter&> video;
+				size_t                  count;
+			};
+
+			// Groups identical videos that follow each other. If `split_first` is set, the first video is never
+			// grouped with the ones after it.
+			static std::vector<Run> find_runs(std::span<const Spanned<const VFilter&>> videos, bool split_first);
+
+			void calculate_parameter_sets();
+			void make_compatible(std::span<const Run> runs, FilterContext& ctx, StreamType type);
+			void calculate_ts_offsets();
+
+			Span                                       m_span;
+			StreamType                                 m_type;
+			std::vector<std::unique_ptr<PacketSource>> m_videos;
+			std::vector<std::vector<uint8_t>>          m_parameter_sets; //< The parameter sets to insert at the start of every video (if any)
+			AVCodecParameters                         *m_codecpar;       //< The output codec parameters (if they differ from the first video's)
+			size_t                                     m_dts_shift;
+			std::vector<int64_t>                       m_pts_offsets; //< How much the pts of every packet in the videos should be offset
+			std::vector<int64_t>                       m_prev_pts;    //< The pts that haven't been used as a dts yet (sorted)
+			int64_t                                    m_dts_origin;  //< The pts of the first packet since the start (or the last seek)
+			size_t                                     m_pkt_idx;
+			size_t                                     m_idx;
+			size_t                                     m_started_idx;
+			AudioSplicer                               m_audio;       //< Lays the audio of the videos end to end
+	};
+
+	static_assert(!std::is_abstract<ConcatPktSource>());
 }
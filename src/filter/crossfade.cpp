@@ -0,0 +1,237 @@
+#include <format>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+#include "src/filter/crossfade.hh"
+#include "src/constants.hh"
+#include "src/filter/concat.hh"
+#include "src/filter/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/trim.hh"
+#include "src/filter/util.hh"
+#include "src/filter/video_file.hh"
+#include "src/util.hh"
+
+extern "C" {
+	#include <libavutil/mathematics.h>
+	#include <libavutil/rational.h>
+}
+
+namespace vcat::filter {
+	Crossfade::Crossfade(Spanned<const VFilter&> first, Spanned<const VFilter&> second, int64_t duration)
+		: m_first(first)
+		, m_second(second)
+		, m_duration(duration)
+	{}
+
+	void Crossfade::hash(Hasher& hasher) const {
+		hasher.add("_crossfade_");
+		const size_t start = hasher.pos();
+
+		m_first->hash(hasher);
+		m_second->hash(hasher);
+
+		hasher.add(m_duration);
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Crossfade::to_string() const {
+		std::stringstream s;
+
+		s << "Crossfade(\n"
+			<< indent(m_first->to_string()) << ",\n"
+			<< indent(m_second->to_string()) << ",\n"
+			<< indent(std::format("{}", av_q2d(constants::TIMEBASE) * m_duration))
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string Crossfade::type_name() const {
+		return "Crossfade";
+	}
+
+	void Crossfade::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		m_first->count_codecs(counts);
+		m_second->count_codecs(counts);
+	}
+
+	std::optional<int64_t> Crossfade::duration(FilterContext& ctx, Span) const {
+		const std::optional<int64_t> first  = m_first->duration(ctx, m_first.span);
+		const std::optional<int64_t> second = m_second->duration(ctx, m_second.span);
+
+		if(!first || !second) {
+			return std::nullopt;
+		}
+
+		return *first + *second - m_duration;
+	}
+
+	Crossfade::SplitPoints Crossfade::split_points(FilterContext& ctx, Span span) const {
+		const std::optional<int64_t> first_length  = m_first->duration(ctx, m_first.span);
+		const std::optional<int64_t> second_length = m_second->duration(ctx, m_second.span);
+
+		if(!first_length) {
+			throw error::unknown_duration(m_first.span);
+		}
+
+		if(!second_length) {
+			throw error::unknown_duration(m_second.span);
+		}
+
+		SplitPoints points {
+			.first_length  = *first_length,
+			.first_end     = 0,
+			.second_start  = 0,
+			.second_length = *second_length,
+		};
+
+		if(m_duration > points.first_length || m_duration > points.second_length) {
+			throw error::crossfade_too_long(span);
+		}
+
+		points.first_end    = points.first_length - m_duration;
+		points.second_start = m_duration;
+
+		// Video files are cut at their keyframes so that the copied parts don't have to be smart-rendered
+		if(const VideoFile *file = dynamic_cast<const VideoFile *>(&m_first.val); file && points.first_end > 0) {
+			const std::optional<TimeRange> copied = file->copyable_range(ctx, m_first.span, TimeRange {.start = 0, .end = points.first_end});
+			points.first_end = copied ? copied->end.value_or(points.first_end) : 0;
+		}
+
+		if(const VideoFile *file = dynamic_cast<const VideoFile *>(&m_second.val)) {
+			const std::optional<TimeRange> copied = file->copyable_range(ctx, m_second.span, TimeRange {.start = m_duration, .end = std::nullopt});
+			points.second_start = copied ? copied->start : points.second_length;
+		}
+
+		return points;
+	}
+
+	std::unique_ptr<PacketSource> Crossfade::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		const SplitPoints points = split_points(ctx, span);
+
+		bool copy_first  = points.first_end > 0;
+		bool copy_second = points.second_start < points.second_length;
+
+		if(!copy_first && !copy_second) {
+			return encode(ctx, span, *this, type);
+		}
+
+		// The copied parts are only opened here, so they can be checked before anything is encoded
+		std::unique_ptr<PacketSource> first_head;
+		std::unique_ptr<PacketSource> second_tail;
+
+		if(copy_first) {
+			first_head = Trim(m_first, TimeRange {.start = 0, .end = points.first_end}).get_pkts(ctx, type, span);
+		}
+
+		// Only the start of the output can have pre-roll
+		const bool allow_preroll = ctx.allow_preroll;
+		ctx.allow_preroll = false;
+
+		if(copy_second) {
+			second_tail = Trim(m_second, TimeRange {.start = points.second_start, .end = std::nullopt}).get_pkts(ctx, type, span);
+		}
+
+		// If the copied parts can't be joined to each other, the second video is re-encoded with the fade instead
+		if(first_head && second_tail && !ConcatPktSource::spliceable(second_tail->video_codec(), first_head->video_codec())) {
+			second_tail = nullptr;
+			copy_second = false;
+		}
+
+		const AVCodecParameters *reference = first_head ? first_head->video_codec() : second_tail->video_codec();
+
+		// The window is encoded to match the copied parts (see `util::encoder_can_match`). AAC always matches, since
+		// only audio in the output format is copied.
+		if(type == StreamType::Video && !util::encoder_can_match(reference, ctx.vparams)) {
+			ctx.allow_preroll = allow_preroll;
+			return encode(ctx, span, *this, type);
+		}
+
+		// The re-encoded window is a crossfade of the parts that aren't copied
+		const Trim first_tail(m_first, TimeRange {.start = points.first_end, .end = std::nullopt});
+		const Trim second_head(m_second, TimeRange {.start = 0, .end = points.second_start});
+
+		const Crossfade window(
+			copy_first  ? Spanned<const VFilter&>(first_tail, m_first.span)   : m_first,
+			copy_second ? Spanned<const VFilter&>(second_head, m_second.span) : m_second,
+			m_duration
+		);
+
+		std::vector<std::unique_ptr<PacketSource>> parts;
+
+		if(first_head) {
+			parts.push_back(std::move(first_head));
+		}
+
+		parts.push_back(encode(ctx, span, window, type, type == StreamType::Video ? reference : nullptr));
+
+		if(second_tail) {
+			parts.push_back(std::move(second_tail));
+		}
+
+		ctx.allow_preroll = allow_preroll;
+
+		const AVCodecParameters *first_codec = parts[0]->video_codec();
+
+		for(const auto& part : parts) {
+			if(!ConcatPktSource::spliceable(part->video_codec(), first_codec)) {
+				return encode(ctx, span, *this, type);
+			}
+		}
+
+		return std::make_unique<ConcatPktSource>(span, std::move(parts), type);
+	}
+
+	std::unique_ptr<FrameSource> Crossfade::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		// Not `video_length`, which could encode a whole clip just to measure it
+		const std::optional<int64_t> first_duration  = m_first->duration(ctx, m_first.span);
+		const std::optional<int64_t> second_duration = m_second->duration(ctx, m_second.span);
+
+		if(!first_duration) {
+			throw error::unknown_duration(m_first.span);
+		}
+
+		if(!second_duration) {
+			throw error::unknown_duration(m_second.span);
+		}
+
+		const int64_t first_length = *first_duration;
+
+		if(m_duration > first_length || m_duration > *second_duration) {
+			throw error::crossfade_too_long(span);
+		}
+
+		const double timebase = av_q2d(constants::TIMEBASE);
+
+		std::string filter;
+
+		if(type == StreamType::Video) {
+			filter = std::format(
+				"[in_0] [in_1] xfade=transition=fade:duration={}:offset={} [out]",
+				m_duration * timebase,
+				(first_length - m_duration) * timebase
+			);
+		} else {
+			const int64_t end_sample = av_rescale_q(first_length, constants::TIMEBASE, AVRational {1, ctx.aparams.sample_rate});
+
+			// The first audio is cut/padded to the length of its video so that the second one stays in sync
+			filter = std::format(
+				"[in_0] atrim=end_sample={0},apad=whole_len={0} [first]; "
+				"[first] [in_1] acrossfade=duration={1} [out]",
+				end_sample,
+				m_duration * timebase
+			);
+		}
+
+		std::vector<std::unique_ptr<FrameSource>> sources;
+		sources.push_back(m_first->get_frames(ctx, type, m_first.span));
+		sources.push_back(m_second->get_frames(ctx, type, m_second.span));
+
+		const StreamType input_types[] = {type, type};
+
+		return std::make_unique<FFMpegFilter>(span, std::move(sources), filter.c_str(), ctx, input_types, type);
+	}
+}
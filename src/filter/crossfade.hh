@@ -0,0 +1,57 @@
+#pragma once
+
+#include "src/filter/filter.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace vcat::filter {
+	// Plays one video after another with the last `duration` of the first one faded into the start of the second.
+	//
+	// Only the GOPs around the overlap are re-encoded. The rest of both videos is copied like in a `Trim`.
+	class Crossfade : public VFilter {
+		public:
+			Crossfade() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			inline Spanned<const VFilter&> first() const {
+				return m_first;
+			}
+
+			inline Spanned<const VFilter&> second() const {
+				return m_second;
+			}
+
+			// Gets the length of the overlap
+			inline int64_t fade_duration() const {
+				return m_duration;
+			}
+
+			// NOTE: `duration` must be positive
+			Crossfade(Spanned<const VFilter&> first, Spanned<const VFilter&> second, int64_t duration);
+
+		private:
+			// Where the videos are cut into the copied and re-encoded parts
+			struct SplitPoints {
+				int64_t first_length;
+				int64_t first_end;    //< The end of the copied part of the first video (a keyframe if possible)
+				int64_t second_start; //< The start of the copied part of the second video (a keyframe if possible)
+				int64_t second_length;
+			};
+
+			SplitPoints split_points(FilterContext& ctx, Span span) const;
+
+			Spanned<const VFilter&> m_first;
+			Spanned<const VFilter&> m_second;
+			int64_t                 m_duration;
+	};
+
+	static_assert(!std::is_abstract<Crossfade>());
+}
@@ -41,6 +41,61 @@ namespace vcat::filter::error {
 		);
 	}
 
+	inline Diagnostic empty_range(Span s) {
+		return Diagnostic(
+			"Range does not contain any part of the video",
+			{
+				Hint::error("", s)
+			}
+		);
+	}
+
+	inline Diagnostic crossfade_too_long(Span s) {
+		return Diagnostic(
+			"The crossfade is longer than one of the videos",
+			{
+				Hint::error("", s)
+			}
+		);
+	}
+
+	inline Diagnostic unknown_duration(Span s) {
+		return Diagnostic(
+			"The length of the video could not be determined",
+			{
+				Hint::error("", s)
+			}
+		);
+	}
+
+	inline Diagnostic missing_parameter_sets(Span s) {
+		return Diagnostic(
+			"Cannot join the videos because the parameter sets of one of them could not be read",
+			{
+				Hint::error("", s)
+			}
+		);
+	}
+
+	inline Diagnostic cannot_match_video(Span s, Span reference) {
+		return Diagnostic(
+			"This video cannot be re-encoded so that it joins with the copied ones; pass `--no-lossless` to re-encode all of them",
+			{
+				Hint::error("", s),
+				Hint::info("The video that is copied", reference)
+			}
+		);
+	}
+
+	inline Diagnostic empty_image(Span s) {
+		return Diagnostic(
+			"The image does not contain any frames",
+			{
+				Hint::error("", s)
+			}
+		);
+	}
+
 	inline Diagnostic no_pts(Span s) {
 		return Diagnostic(
 			"No pts value found for frame",
@@ -1,5 +1,8 @@
 #include "src/filter/filter.hh"
 #include "libavutil/pixfmt.h"
+#include "src/filter/audio_convert.hh"
+#include "src/filter/fps_convert.hh"
+#include "src/filter/pool.hh"
 #include "src/constants.hh"
 #include "src/error.hh"
 #include "src/filter/error.hh"
@@ -7,6 +10,7 @@
 #include "src/util.hh"
 #include "src/filter/util.hh"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstddef>
@@ -103,11 +107,16 @@ namespace vcat::filter {
 			info.color_range     == constants::COLOR_RANGE             &&
 			info.color_primaries == constants::COLOR_PRIMARIES         &&
 			info.color_trc       == constants::COLOR_TRANSFER_FUNCTION &&
-			!output.fixed_fps                                          &&
+			info.rotation_degrees == 0.0                               &&
 			av_cmp_q(info.sar, constants::SAMPLE_ASPECT_RATIO) == 0
 		) {
+			if(output.fixed_fps) {
+				return std::make_unique<FpsConvert>(span, std::move(src), output.fps);
+			}
+
 			return std::move(src);
 		}
+
 		std::string filter_string = std::format(
 				"colorspace="
 					"space={}:"
@@ -145,16 +154,18 @@ namespace vcat::filter {
 				output.height
 		);
 
-		if(output.fixed_fps) {
-			filter_string += std::format(",fps={}", output.fps);
-		}
-
 		const util::SFrameInfo s_info{info};
 
 		std::vector<std::unique_ptr<FrameSource>> sources;
 		sources.push_back(std::move(src));
 
-		return std::make_unique<FFMpegFilter>(span, std::move(sources), filter_string.c_str(), std::span(&s_info, 1), StreamType::Video);
+		auto filtered = std::make_unique<FFMpegFilter>(span, std::move(sources), filter_string.c_str(), std::span(&s_info, 1), StreamType::Video);
+
+		if(output.fixed_fps) {
+			return std::make_unique<FpsConvert>(span, std::move(filtered), output.fps);
+		}
+
+		return filtered;
 	}
 
 	std::unique_ptr<FrameSource> resample(Span span, std::unique_ptr<FrameSource>&& src, const util::AFrameInfo& info, const AudioParameters& output, std::optional<int64_t> out_duration) {
@@ -170,6 +181,11 @@ namespace vcat::filter {
 			return std::move(src);
 		}
 
+		// Sample format and channel layout conversions don't need a filtergraph
+		if(!out_duration && AudioConvert::can_convert(info, output)) {
+			return std::make_unique<AudioConvert>(span, std::move(src), info, output);
+		}
+
 		if(out_duration && do_resample) {
 			// Do a quick & dirty trim first so that we don't have to resample as much audio
 			const AVRational sample_dur = {1, info.sample_rate};
@@ -217,13 +233,34 @@ namespace vcat::filter {
 		return std::make_unique<FFMpegFilter>(span, std::move(sources), filter_string.c_str(), std::span(&s_info, 1), StreamType::Audio);
 	}
 
-	Decode::Decode(Span s, std::unique_ptr<PacketSource>&& packet_src)
+	Decode::Decode(Span s, std::unique_ptr<PacketSource>&& packet_src, const VideoParameters *output)
 		: m_span(s)
 		, m_packets(std::move(packet_src))
-		, m_decoder(util::create_decoder(m_span, m_packets->video_codec()))
-		, m_pkt_buf(av_packet_alloc())
+		, m_decoder(util::create_decoder(m_span, m_packets->video_codec(), output))
+		, m_pkt_buf(pool::alloc_packet())
 	{
 		error::handle_ffmpeg_error(m_span, m_pkt_buf ? 0 : AVERROR(ENOMEM));
+
+		if(output && output->fixed_fps) {
+			m_drop_grid = util::FrameRateGrid(output->fps);
+		}
+	}
+
+	bool FrameSource::seek(int64_t) {
+		return false;
+	}
+
+	bool PacketSource::seek(int64_t) {
+		return false;
+	}
+
+	bool Decode::seek(int64_t ts) {
+		if(!m_packets->seek(ts)) {
+			return false;
+		}
+
+		avcodec_flush_buffers(m_decoder);
+		return true;
 	}
 
 	bool Decode::next_frame(AVFrame **frame) {
@@ -260,6 +297,8 @@ namespace vcat::filter {
 				continue;
 			}
 
+			update_skip_frame();
+
 			error::handle_ffmpeg_error(m_span,
 				avcodec_send_packet(m_decoder, m_pkt_buf)
 			);
@@ -268,12 +307,33 @@ namespace vcat::filter {
 		}
 	}
 
+	void Decode::update_skip_frame() {
+		if(!m_drop_grid) {
+			return;
+		}
+
+		const AVPacket *const pkt = m_pkt_buf;
+
+		// A frame is dropped by `FpsConvert` if the next frame lands in the same slot. Packet durations are
+		// the distance to the next frame in presentation order, so this can be determined before decoding.
+		//
+		// Keyframes are always decoded so that the output is never empty.
+		const bool dropped =
+			!(pkt->flags & AV_PKT_FLAG_KEY) &&
+			pkt->pts != AV_NOPTS_VALUE      &&
+			pkt->duration > 0               &&
+			m_drop_grid->slot(pkt->pts) == m_drop_grid->slot(pkt->pts + pkt->duration);
+
+		// The decoder will still decode dropped frames that other frames depend on
+		m_decoder->skip_frame = dropped ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	}
+
 	Decode::~Decode() {
 		avcodec_free_context(&m_decoder);
-		av_packet_free(&m_pkt_buf);
+		pool::free_packet(&m_pkt_buf);
 	}
 
-	std::unique_ptr<PacketSource> encode(FilterContext& ctx, Span span, const VFilter& filter, StreamType type) {
+	std::unique_ptr<PacketSource> encode(FilterContext& ctx, Span span, const VFilter& filter, StreamType type, const AVCodecParameters *reference) {
 		std::string hash;
 		{
 			Hasher hasher;
@@ -282,6 +342,8 @@ namespace vcat::filter {
 
 			const size_t start = hasher.pos();
 
+			hasher.add(constants::ENCODER_CONFIG_VERSION);
+
 			if(type == StreamType::Video) {
 				ctx.vparams.hash(hasher);
 			} else {
@@ -290,6 +352,17 @@ namespace vcat::filter {
 
 			filter.hash(hasher);
 
+			// Only the parts of the reference that the encoder copies are hashed
+			if(type == StreamType::Video && reference) {
+				hasher.add("_encoder-reference_");
+				hasher.add(reference->color_space);
+				hasher.add(reference->color_range);
+				hasher.add(reference->color_primaries);
+				hasher.add(reference->color_trc);
+				hasher.add(reference->chroma_location);
+				hasher.add(reference->field_order);
+			}
+
 			hasher.add(static_cast<uint64_t>(hasher.pos() - start));
 
 			hash = hasher.into_string();
@@ -330,7 +403,7 @@ namespace vcat::filter {
 
 		AVCodecContext *encoder;
 		if(type == StreamType::Video) {
-			encoder = util::create_video_encoder(span, ctx.vparams);
+			encoder = util::create_video_encoder(span, ctx.vparams, reference);
 		} else {
 			encoder = util::create_audio_encoder(span, ctx.aparams);
 		}
@@ -355,8 +428,8 @@ namespace vcat::filter {
 			avformat_write_header(output, nullptr)
 		);
 
-		AVFrame  *frame  = av_frame_alloc();
-		AVPacket *packet = av_packet_alloc();
+		AVFrame  *frame  = pool::alloc_frame();
+		AVPacket *packet = pool::alloc_packet();
 
 		error::handle_ffmpeg_error(span, frame  ? 0 : AVERROR_UNKNOWN);
 		error::handle_ffmpeg_error(span, packet ? 0 : AVERROR_UNKNOWN);
@@ -414,8 +487,8 @@ namespace vcat::filter {
 			av_write_trailer(output)
 		);
 
-		av_packet_free(&packet);
-		av_frame_free(&frame);
+		pool::free_packet(&packet);
+		pool::free_frame(&frame);
 
 		avcodec_free_context(&encoder);
 
@@ -436,6 +509,48 @@ namespace vcat::filter {
 		return encode(ctx, span, *this, type);
 	}
 
+	void VFilter::count_codecs(std::map<AVCodecID, size_t>&) const {}
+
+	int64_t video_length(FilterContext& ctx, Spanned<const VFilter&> video) {
+		if(const std::optional<int64_t> duration = video->duration(ctx, video.span)) {
+			return *duration;
+		}
+
+		const TsInfo end = video->get_pkts(ctx, StreamType::Video, video.span)->pts_end_info();
+
+		return end.ts + end.duration;
+	}
+
+	std::optional<int64_t> VFilter::duration(FilterContext&, Span) const {
+		return std::nullopt;
+	}
+
+	shared::VideoCodec choose_video_codec(const VFilter& filter) {
+		std::map<AVCodecID, size_t> counts;
+		filter.count_codecs(counts);
+
+		// Only H.264 has a way of joining copied videos with re-encoded ones or with each other when their headers
+		// differ (see `util::encoder_can_match`), so the other codecs are only picked when every source video
+		// already uses them
+		for(shared::VideoCodec codec : {shared::hevc, shared::av1}) {
+			const AVCodecID codec_id = util::VideoCodec_get_AVCodecID(codec);
+
+			if(!avcodec_find_encoder(codec_id) || counts[codec_id] == 0) {
+				continue;
+			}
+
+			const bool only_codec = std::ranges::all_of(counts, [&](const auto& count) {
+				return count.first == codec_id || count.second == 0;
+			});
+
+			if(only_codec) {
+				return codec;
+			}
+		}
+
+		return shared::h264;
+	}
+
 	AVMediaType StreamType_to_AVMediaType(StreamType type) {
 		switch(type) {
 			case StreamType::Video:
@@ -6,8 +6,11 @@
 #include "src/filter/util.hh"
 #include "src/util.hh"
 #include <cstdint>
+#include <map>
 #include <memory>
+#include <optional>
 #include <ranges>
+#include <utility>
 #include <vector>
 
 extern "C" {
@@ -27,10 +30,16 @@ namespace vcat::filter {
 			constexpr FilterContext(VideoParameters&& vparams, AudioParameters&& aparams)
 				: vparams(std::move(vparams))
 				, aparams(std::move(aparams))
+				, allow_preroll(false)
 			{}
 
 			VideoParameters vparams;
 			AudioParameters aparams;
+
+			// Whether the packets being requested may start with frames before the start of the timeline (with
+			// negative timestamps). The muxer hides these with an edit list, so only the start of the output can
+			// have them.
+			bool allow_preroll;
 	};
 
 	struct TsInfo {
@@ -38,12 +47,23 @@ namespace vcat::filter {
 		int64_t duration;
 	};
 
+	// A range of a video's timeline (in `constants::TIMEBASE`)
+	struct TimeRange {
+		int64_t                start;
+		std::optional<int64_t> end; //< Exclusive (the end of the video if unspecified)
+	};
+
 	class FrameSource {
 		public:
 			// Gets the next frame or returns false if `EOF` is reached
 			//
 			// A double pointer is used to allow for more efficient 'look-ahead' buffers for filters
 			virtual bool next_frame(AVFrame **frame) = 0;
+
+			// Moves to `ts` (in `constants::TIMEBASE`) so that the next frames start at or before it. Returns `false`
+			// (and does nothing) if the source can't seek.
+			virtual bool seek(int64_t ts);
+
 			virtual ~FrameSource() = default;
 	};
 
@@ -57,6 +77,12 @@ namespace vcat::filter {
 			virtual int64_t first_pkt_duration() const = 0;
 			virtual size_t  dts_shift() const = 0;
 			virtual TsInfo  pts_end_info() const = 0;
+
+			// Moves to `ts` (in `constants::TIMEBASE`) so that the next packet is the first one that is needed to show
+			// it (ie the last keyframe at or before `ts`). The timestamps of the packets are unchanged. Returns
+			// `false` (and does nothing) if the source can't seek.
+			virtual bool seek(int64_t ts);
+
 			virtual ~PacketSource() = default;
 	};
 
@@ -71,25 +97,64 @@ namespace vcat::filter {
 		public:
 			virtual std::unique_ptr<PacketSource> get_pkts(FilterContext&, StreamType, Span) const;
 			virtual std::unique_ptr<FrameSource>  get_frames(FilterContext&, StreamType, Span) const = 0;
+
+			// Counts the video codecs of the source videos that could be copied into the output (see
+			// `choose_video_codec`)
+			virtual void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+
+			// Gets the length of the timeline (in `constants::TIMEBASE`) if it is known without rendering anything
+			virtual std::optional<int64_t> duration(FilterContext&, Span) const;
 	};
 	static_assert(std::is_abstract<VFilter>());
 
-	std::unique_ptr<PacketSource> encode(FilterContext& ctx, Span span, const VFilter& filter, StreamType);
+	// If `reference` is specified, the video is encoded so that it can be spliced with it (see
+	// `util::encoder_can_match`)
+	std::unique_ptr<PacketSource> encode(FilterContext& ctx, Span span, const VFilter& filter, StreamType, const AVCodecParameters *reference = nullptr);
+
+	// Gets the length of a video's timeline. If it isn't known up front (see `VFilter::duration`), the video is
+	// encoded (which is cached either way).
+	int64_t video_length(FilterContext& ctx, Spanned<const VFilter&> video);
+
+	// Picks H.264 unless every source video already uses another codec that can be encoded
+	shared::VideoCodec choose_video_codec(const VFilter& filter);
 
 	struct PacketTimestampInfo {
 		int64_t pts;
 		int64_t dts;
 		int64_t duration;
 		size_t  decode_idx;
+		bool    keyframe;
+	};
+
+	// The packets of one stream of a file (see `VideoFilePktSource::index_file`)
+	struct StreamIndex {
+		int64_t stream_idx;
+		size_t  dts_shift;
+		int64_t pts_shift;   //< How much is subtracted from every pts so that audio priming has negative timestamps
+		int64_t end_padding; //< The duration of the padding samples at the end of the last audio packet
+
+		std::vector<PacketTimestampInfo> ts_info;
+	};
+
+	// The packets of the first video and audio streams of a file (`std::nullopt` if the file doesn't have one)
+	struct FileIndex {
+		std::optional<StreamIndex> video;
+		std::optional<StreamIndex> audio;
 	};
 
 	class VideoFilePktSource : public PacketSource {
 		private:
-			AVFormatContext *m_ctx;
+			AVFormatContext *m_ctx;    //< `nullptr` until packets or codec parameters are needed (see `open`)
 			Span             m_span;
 			size_t           m_dts_shift;
 			int64_t          m_stream_idx;
 			size_t           m_pkt_no; //< The index of the current packet (starting at 0)
+			int64_t          m_pts_shift;   //< How much is subtracted from every pts so that audio priming has negative timestamps
+			int64_t          m_end_padding; //< The duration of the padding samples at the end of the last audio packet
+			std::optional<int64_t> m_seek_pts; //< The pts (before `m_pts_shift`) to seek to before reading the next packet
+			std::vector<size_t> m_keyframes;   //< The indices of the keyframes in `m_ts_info`
+			StreamType       m_type;
+			std::string      m_path;
 
 			std::vector<PacketTimestampInfo> m_ts_info;
 
@@ -98,22 +163,63 @@ namespace vcat::filter {
 			VideoFilePktSource() = delete;
 
 			VideoFilePktSource(FilterContext& fctx, StreamType, const std::string& path, Span span);
+
+			// Uses an index of the file that has already been made instead of reading the whole file again
+			VideoFilePktSource(StreamType, const std::string& path, const FileIndex& index, Span span);
+
+			// Finds the timestamps of the packets of the first video and audio streams of a file. They are taken from
+			// the demuxer's index (ie the MP4 sample table) when possible, and the packets are only read otherwise.
+			static FileIndex index_file(FilterContext& fctx, const std::string& path, Span span);
+
 			bool next_pkt(AVPacket **p_packet);
 			const AVCodecParameters *video_codec();
 			std::span<AVStream *> av_streams();
 			int64_t first_pkt_duration() const;
 			size_t  dts_shift() const;
 			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+			// Checks if every frame lands on its own slot of `grid` (ie the video already has that framerate)
+			bool timestamps_on_grid(const util::FrameRateGrid& grid) const;
+
+			// Moves the ends of a range to the nearest frame boundaries
+			TimeRange snap(const TimeRange& range) const;
+
+			// Skips to the packets that are needed to decode the frames in `range`. The timestamps are unchanged.
+			void seek_range(const TimeRange& range);
+
+			// Limits the packets to the ones in `range` and moves the start of `range` to 0. Returns `false` (and
+			// does nothing) if any of them reference packets outside of the range.
+			//
+			// With `preroll`, the packets from the keyframe before the range are kept (with negative timestamps)
+			// instead of requiring the range to start at a keyframe.
+			bool trim(const TimeRange& range, bool preroll = false);
+
+			// Finds the largest part of `range` that `trim` accepts (ie that starts and ends at keyframes which
+			// nothing references across)
+			std::optional<TimeRange> copyable_range(const TimeRange& range) const;
 
 			~VideoFilePktSource();
 
 			VideoFilePktSource(VideoFilePktSource&& old);
 
 		private:
-			// Walks through the file to calculate `m_dts_shift`, `m_pts_end_info`, and `video_idx`
-			//
-			// NOTE: this should be called before the main AVFormatContext is created.
-			void calculate_info(FilterContext& ctx, StreamType, const std::string& path);
+			void forward_display_matrix(AVPacket *packet);
+
+			// Gets the first and last+1 decode indices of the packets that are needed for the frames in `range`
+			std::pair<size_t, size_t> decode_range(const TimeRange& range, bool preroll) const;
+
+			// Finds the keyframes that no packet references across (indexed like `m_ts_info`)
+			std::vector<bool> clean_cuts() const;
+
+			// Removes the packets outside of a range of decode indices
+			void restrict_packets(size_t begin, size_t end);
+
+			void index_keyframes();
+
+			// Opens the file for reading if it isn't open yet. The timestamps are already known from the index, so
+			// sources that are only used for them never open the file.
+			void open();
 	};
 
 	class FFMpegFilter : public FrameSource {
@@ -150,15 +256,25 @@ namespace vcat::filter {
 
 	class Decode : public FrameSource {
 		public:
-			Decode(Span s, std::unique_ptr<PacketSource>&& packet_src);
+			// If `output` is specified, frames that already have the output dimensions are allocated from a
+			// buffer pool, and (for fixed-framerate output) non-reference frames that will be dropped when
+			// converting to the output framerate (see `FpsConvert`) are not decoded.
+			//
+			// NOTE: `output` must outlive the decoder
+			Decode(Span s, std::unique_ptr<PacketSource>&& packet_src, const VideoParameters *output = nullptr);
 			bool next_frame(AVFrame **frame);
+			bool seek(int64_t ts);
 			~Decode();
 
 		private:
-			Span                          m_span;
-			std::unique_ptr<PacketSource> m_packets;
-			AVCodecContext               *m_decoder;
-			AVPacket                     *m_pkt_buf;
+			// Sets the decoder's `skip_frame` for the packet in `m_pkt_buf`
+			void update_skip_frame();
+
+			Span                               m_span;
+			std::unique_ptr<PacketSource>      m_packets;
+			AVCodecContext                    *m_decoder;
+			AVPacket                          *m_pkt_buf;
+			std::optional<util::FrameRateGrid> m_drop_grid;
 	};
 
 	std::unique_ptr<FrameSource> rescale(Span span, std::unique_ptr<FrameSource>&& src, const util::VFrameInfo& info, const VideoParameters& output);
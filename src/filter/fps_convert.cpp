@@ -0,0 +1,102 @@
+#include "src/filter/fps_convert.hh"
+#include "src/filter/error.hh"
+#include "src/filter/pool.hh"
+
+#include <algorithm>
+#include <utility>
+
+extern "C" {
+	#include <libavutil/frame.h>
+}
+
+namespace vcat::filter {
+	FpsConvert::FpsConvert(Span span, std::unique_ptr<FrameSource>&& src, double fps)
+		: m_span(span)
+		, m_src(std::move(src))
+		, m_grid(fps)
+		, m_cur(pool::alloc_frame())
+		, m_next(pool::alloc_frame())
+		, m_cur_valid(false)
+		, m_next_valid(false)
+		, m_started(false)
+		, m_slot(0)
+		, m_cur_end(0)
+		, m_num_out(0)
+	{
+		error::handle_ffmpeg_error(m_span, m_cur && m_next ? 0 : AVERROR(ENOMEM));
+	}
+
+	bool FpsConvert::next_frame(AVFrame **p_frame) {
+		if(!m_started) {
+			m_started = true;
+
+			if(!m_src->next_frame(&m_cur)) {
+				return false;
+			}
+
+			m_cur_valid = true;
+			m_slot = m_grid.slot(m_cur->pts);
+
+			read_next();
+		}
+
+		// Drop every frame that doesn't cover the current slot
+		while(m_cur_valid && m_slot >= m_cur_end) {
+			av_frame_unref(m_cur);
+
+			if(!m_next_valid) {
+				m_cur_valid = false;
+				break;
+			}
+
+			std::swap(m_cur, m_next);
+			m_next_valid = false;
+
+			read_next();
+		}
+
+		if(!m_cur_valid) {
+			return false;
+		}
+
+		if(m_slot + 1 == m_cur_end) {
+			// This is the last time that this frame is shown, so we can just hand it over
+			std::swap(*p_frame, m_cur);
+		} else {
+			error::handle_ffmpeg_error(m_span,
+				av_frame_ref(*p_frame, m_cur)
+			);
+		}
+
+		AVFrame *const frame = *p_frame;
+
+		frame->pts      = m_grid.pts(m_slot);
+		frame->duration = m_grid.pts(m_slot + 1) - frame->pts;
+
+		m_slot    += 1;
+		m_num_out += 1;
+
+		return true;
+	}
+
+	void FpsConvert::read_next() {
+		m_next_valid = m_src->next_frame(&m_next);
+
+		if(m_next_valid) {
+			m_cur_end = m_grid.slot(m_next->pts);
+			return;
+		}
+
+		m_cur_end = m_grid.slot(m_cur->pts + m_cur->duration);
+
+		// Never output an empty video
+		if(m_num_out == 0) {
+			m_cur_end = std::max(m_cur_end, m_slot + 1);
+		}
+	}
+
+	FpsConvert::~FpsConvert() {
+		pool::free_frame(&m_cur);
+		pool::free_frame(&m_next);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/util.hh"
+
+#include <cstdint>
+#include <memory>
+
+extern "C" {
+	#include <libavutil/frame.h>
+}
+
+namespace vcat::filter {
+	// Conforms video to a fixed framerate by dropping and duplicating frames.
+	//
+	// This behaves like FFMPEG's `fps` filter (with `round=near`), but duplicated frames are new references
+	// to the same buffers, so no pixel data is ever copied.
+	class FpsConvert : public FrameSource {
+		public:
+			FpsConvert() = delete;
+			FpsConvert(FpsConvert&) = delete;
+
+			FpsConvert(Span span, std::unique_ptr<FrameSource>&& src, double fps);
+
+			bool next_frame(AVFrame **frame);
+			~FpsConvert();
+
+		private:
+			// Reads the frame after `m_cur` and calculates `m_cur_end`
+			void read_next();
+
+			Span                         m_span;
+			std::unique_ptr<FrameSource> m_src;
+			util::FrameRateGrid          m_grid;
+
+			AVFrame                     *m_cur;
+			AVFrame                     *m_next;
+			bool                         m_cur_valid;
+			bool                         m_next_valid;
+			bool                         m_started;
+
+			int64_t                      m_slot;      //< The next slot to output
+			int64_t                      m_cur_end;   //< The slot after the last slot that `m_cur` is shown in
+			size_t                       m_num_out;   //< The number of frames that have been output
+	};
+
+	static_assert(!std::is_abstract<FpsConvert>());
+}
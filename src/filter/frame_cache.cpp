@@ -0,0 +1,459 @@
+#include "src/filter/frame_cache.hh"
+#include "src/constants.hh"
+#include "src/filter/error.hh"
+#include "src/filter/params.hh"
+#include "src/filter/util.hh"
+#include "src/filter/video_file.hh"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <deque>
+#include <format>
+#include <list>
+#include <map>
+#include <optional>
+#include <set>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/buffer.h>
+	#include <libavutil/error.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/imgutils.h>
+	#include <libavutil/rational.h>
+	#include <libavutil/samplefmt.h>
+}
+
+namespace vcat::filter::frame_cache {
+	namespace {
+		// The frames of a video, which are read from it as they are needed
+		//
+		// NOTE: the frames are kept for as long as the cache, so they are allocated directly instead of through
+		// `pool`
+		class Recording {
+			public:
+				Recording(const Recording&) = delete;
+
+				Recording(Key key, std::unique_ptr<FrameSource>&& src)
+					: m_key(key)
+					, m_src(std::move(src))
+					, m_first(0)
+					, m_size(0)
+					, m_reading(true)
+				{}
+
+				// Gets frame `idx`, reading it from the video if needed. Returns `nullptr` after the last frame.
+				//
+				// NOTE: `idx` must not be before `first()`
+				const AVFrame *frame(Span span, size_t idx);
+
+				// Gets the index of the first frame that ends after `ts`, reading frames until there is one. Returns the
+				// number of frames if there is none.
+				size_t find(Span span, int64_t ts);
+
+				inline const Key& key() const {
+					return m_key;
+				}
+
+				inline size_t size() const {
+					return m_size;
+				}
+
+				// Gets the index of the first frame that is still kept. Frames are only dropped once the recording
+				// has been given up on (see `abandon`).
+				inline size_t first() const {
+					return m_first;
+				}
+
+				~Recording();
+
+			private:
+				// Stops recording because the frames don't fit in `max_bytes()`. From then on, only the newest frame is
+				// kept, and readers that fall behind read the video themselves.
+				void abandon();
+
+				Key                          m_key;
+				std::unique_ptr<FrameSource> m_src;     //< `nullptr` once the whole video has been read
+				std::deque<AVFrame *>        m_frames;
+				size_t                       m_first;   //< The index of `m_frames[0]`
+				size_t                       m_size;    //< The size of the frame data (in bytes)
+				bool                         m_reading; //< Whether `m_size` counts towards `Registry::reading_size`
+		};
+
+		using RecordingList = std::list<std::shared_ptr<Recording>>;
+
+		struct Registry {
+			RecordingList                           complete;     //< The most recently used ones first
+			std::map<Key, RecordingList::iterator>  complete_idx;
+			std::map<Key, std::weak_ptr<Recording>> reading;      //< The ones that are still being read
+			std::set<Key>                           too_large;    //< The ones that turned out not to fit
+			size_t                                  size;         //< The total size of the complete ones
+			size_t                                  reading_size; //< The total size of the ones that are still being read
+			size_t                                  max_bytes;
+			size_t                                  peak;         //< The largest total size so far
+		};
+
+		// Replays the frames of a recording. If frames that it still needs have been dropped, it reads the video
+		// itself instead.
+		class ReplayFrameSource : public FrameSource {
+			public:
+				ReplayFrameSource(FilterContext& ctx, Spanned<const VFilter&> video, StreamType type, std::shared_ptr<Recording> recording)
+					: m_ctx(ctx)
+					, m_video(video)
+					, m_type(type)
+					, m_recording(std::move(recording))
+					, m_idx(0)
+					, m_last_pts()
+				{}
+
+				bool next_frame(AVFrame **frame) {
+					if(m_recording && m_idx < m_recording->first()) {
+						fall_back();
+					}
+
+					if(m_src) {
+						// The video starts over (or at a keyframe), so the frames that were already replayed are skipped
+						do {
+							if(!m_src->next_frame(frame)) {
+								return false;
+							}
+						} while(m_last_pts && (*frame)->pts <= *m_last_pts);
+
+						m_last_pts = (*frame)->pts;
+						return true;
+					}
+
+					const AVFrame *cached = m_recording->frame(m_video.span, m_idx);
+
+					if(!cached) {
+						return false;
+					}
+
+					m_idx++;
+
+					av_frame_unref(*frame);
+
+					error::handle_ffmpeg_error(m_video.span,
+						av_frame_ref(*frame, cached)
+					);
+
+					m_last_pts = cached->pts;
+
+					return true;
+				}
+
+				bool seek(int64_t ts) {
+					if(m_recording && m_recording->first() > 0) {
+						fall_back();
+					}
+
+					if(m_src) {
+						if(!m_src->seek(ts)) {
+							return false;
+						}
+
+						m_last_pts.reset();
+						return true;
+					}
+
+					// Frames are already decoded, so any frame can be the first
+					m_idx = m_recording->find(m_video.span, ts);
+					m_last_pts.reset();
+
+					return true;
+				}
+
+			private:
+				void fall_back() {
+					m_recording.reset();
+					m_src = m_video->get_frames(m_ctx, m_type, m_video.span);
+
+					if(m_last_pts) {
+						m_src->seek(*m_last_pts + 1);
+					}
+				}
+
+				FilterContext&               m_ctx;
+				Spanned<const VFilter&>      m_video;
+				StreamType                   m_type;
+				std::shared_ptr<Recording>   m_recording; //< `nullptr` once `m_src` is used instead
+				std::unique_ptr<FrameSource> m_src;
+				size_t                       m_idx;
+				std::optional<int64_t>       m_last_pts;  //< The pts of the last frame that was returned
+		};
+	}
+
+	static Registry& registry() {
+		static Registry registry {
+			.complete     = {},
+			.complete_idx = {},
+			.reading      = {},
+			.too_large    = {},
+			.size         = 0,
+			.reading_size = 0,
+			.max_bytes    = DEFAULT_MAX_BYTES,
+			.peak         = 0,
+		};
+
+		return registry;
+	}
+
+	size_t max_bytes() {
+		return registry().max_bytes;
+	}
+
+	void set_max_bytes(size_t bytes) {
+		registry().max_bytes = bytes;
+	}
+
+	std::string stats() {
+		const Registry& reg = registry();
+		constexpr double MIB = 1 << 20;
+
+		return std::format(
+			"frame cache: {:.1f} MiB used at most, {:.1f} MiB allowed (see `--frame-cache-size`)\n",
+			static_cast<double>(reg.peak) / MIB,
+			static_cast<double>(reg.max_bytes) / MIB
+		);
+	}
+
+	static size_t frame_size(const AVFrame *frame) {
+		size_t size = 0;
+
+		for(const AVBufferRef *buf : frame->buf) {
+			size += buf ? buf->size : 0;
+		}
+
+		for(int i = 0; i < frame->nb_extended_buf; i++) {
+			size += frame->extended_buf[i]->size;
+		}
+
+		return size;
+	}
+
+	// Evicts the least recently used complete recordings until everything fits in `max_bytes()` (if possible)
+	static void evict() {
+		Registry& reg = registry();
+
+		reg.peak = std::max(reg.peak, reg.size + reg.reading_size);
+
+		while(reg.size + reg.reading_size > reg.max_bytes && !reg.complete.empty()) {
+			const Recording& oldest = *reg.complete.back();
+
+			// Readers that still use the evicted frames keep them alive
+			reg.size -= oldest.size();
+			reg.complete_idx.erase(oldest.key());
+			reg.complete.pop_back();
+		}
+	}
+
+	// Moves a recording that has been read completely into the cache
+	static void finish(const Key& key, size_t size) {
+		Registry& reg = registry();
+
+		auto reading = reg.reading.find(key);
+
+		if(reading == reg.reading.end()) {
+			return;
+		}
+
+		std::shared_ptr<Recording> recording = reading->second.lock();
+		reg.reading.erase(reading);
+		reg.reading_size -= size;
+
+		if(!recording) {
+			return;
+		}
+
+		reg.complete.push_front(std::move(recording));
+		reg.complete_idx[key] = reg.complete.begin();
+		reg.size += size;
+
+		evict();
+	}
+
+	const AVFrame *Recording::frame(Span span, size_t idx) {
+		Registry& reg = registry();
+
+		while(idx >= m_first + m_frames.size()) {
+			if(!m_src) {
+				return nullptr;
+			}
+
+			AVFrame *frame = av_frame_alloc();
+			error::handle_ffmpeg_error(span, frame ? 0 : AVERROR(ENOMEM));
+
+			if(!m_src->next_frame(&frame)) {
+				av_frame_free(&frame);
+
+				// The video isn't needed anymore (and it may refer to a `FilterContext` that is gone by the time
+				// that the cached frames are used again)
+				m_src.reset();
+
+				if(m_reading) {
+					m_reading = false;
+					finish(m_key, m_size);
+				}
+
+				return nullptr;
+			}
+
+			m_frames.push_back(frame);
+
+			if(m_reading) {
+				const size_t size = frame_size(frame);
+
+				m_size           += size;
+				reg.reading_size += size;
+
+				evict();
+
+				if(reg.reading_size > reg.max_bytes) {
+					abandon();
+				}
+			}
+
+			if(!m_reading) {
+				while(m_frames.size() > 1) {
+					av_frame_free(&m_frames.front());
+					m_frames.pop_front();
+					m_first++;
+				}
+			}
+		}
+
+		return m_frames[idx - m_first];
+	}
+
+	size_t Recording::find(Span span, int64_t ts) {
+		const auto ends_by = [ts](const AVFrame *frame) {
+			return frame->pts + frame->duration <= ts;
+		};
+
+		// Only the frames up to `ts` are read
+		while(m_frames.empty() || ends_by(m_frames.back())) {
+			if(!frame(span, m_first + m_frames.size())) {
+				return m_first + m_frames.size();
+			}
+		}
+
+		return m_first + (std::ranges::partition_point(m_frames, ends_by) - m_frames.begin());
+	}
+
+	void Recording::abandon() {
+		Registry& reg = registry();
+
+		reg.reading_size -= m_size;
+		reg.reading.erase(m_key);
+		reg.too_large.insert(m_key);
+
+		m_reading = false;
+	}
+
+	Recording::~Recording() {
+		// Every reader is gone before the whole video was read
+		if(m_reading) {
+			Registry& reg = registry();
+
+			reg.reading_size -= m_size;
+			reg.reading.erase(m_key);
+		}
+
+		for(AVFrame *frame : m_frames) {
+			av_frame_free(&frame);
+		}
+	}
+
+	// Estimates the size of the frames of a video. Files use the length from their container so that they aren't
+	// read just for this.
+	static std::optional<size_t> estimate_size(FilterContext& ctx, Spanned<const VFilter&> video, StreamType type) {
+		const VideoFile *file = dynamic_cast<const VideoFile *>(&video.val);
+		const std::optional<int64_t> duration = file ? file->container_duration() : video->duration(ctx, video.span);
+
+		if(!duration) {
+			return std::nullopt;
+		}
+
+		const double seconds = av_q2d(constants::TIMEBASE) * static_cast<double>(*duration);
+
+		if(type == StreamType::Video) {
+			const int size = av_image_get_buffer_size(constants::PIXEL_FORMAT, ctx.vparams.width, ctx.vparams.height, 1);
+
+			if(size < 0) {
+				return std::nullopt;
+			}
+
+			return static_cast<size_t>(std::ceil(seconds * ctx.vparams.fps)) * static_cast<size_t>(size);
+		}
+
+		const AVSampleFormat sample_fmt = util::SampleFormat_get_AVSampleFormat(ctx.aparams.sample_format);
+		const size_t sample_size = static_cast<size_t>(av_get_bytes_per_sample(sample_fmt)) * std::popcount(ctx.aparams.channel_layout);
+
+		return static_cast<size_t>(std::ceil(seconds * ctx.aparams.sample_rate)) * sample_size;
+	}
+
+	Key key(const FilterContext& ctx, const VFilter& video, StreamType type) {
+		Hasher hasher;
+
+		hasher.add("_cached-frames_");
+		const size_t start = hasher.pos();
+
+		if(type == StreamType::Video) {
+			hasher.add(static_cast<uint8_t>(0));
+			ctx.vparams.hash(hasher);
+		} else {
+			hasher.add(static_cast<uint8_t>(1));
+			ctx.aparams.hash(hasher);
+		}
+
+		video.hash(hasher);
+
+		hasher.add(static_cast<uint64_t>(hasher.pos() - start));
+
+		return hasher.into_bin();
+	}
+
+	bool contains(const Key& key) {
+		Registry& reg = registry();
+
+		if(reg.complete_idx.contains(key)) {
+			return true;
+		}
+
+		auto reading = reg.reading.find(key);
+		return reading != reg.reading.end() && !reading->second.expired();
+	}
+
+	std::unique_ptr<FrameSource> get_frames(FilterContext& ctx, Spanned<const VFilter&> video, StreamType type, const Key& key) {
+		Registry& reg = registry();
+
+		if(auto it = reg.complete_idx.find(key); it != reg.complete_idx.end()) {
+			// Moves it to the front
+			reg.complete.splice(reg.complete.begin(), reg.complete, it->second);
+
+			return std::make_unique<ReplayFrameSource>(ctx, video, type, *it->second);
+		}
+
+		if(auto it = reg.reading.find(key); it != reg.reading.end()) {
+			if(std::shared_ptr<Recording> recording = it->second.lock()) {
+				return std::make_unique<ReplayFrameSource>(ctx, video, type, std::move(recording));
+			}
+		}
+
+		if(reg.too_large.contains(key)) {
+			return video->get_frames(ctx, type, video.span);
+		}
+
+		// Videos whose size is unknown are recorded until they run out of room
+		const std::optional<size_t> size = estimate_size(ctx, video, type);
+
+		if(size && *size > reg.max_bytes) {
+			return video->get_frames(ctx, type, video.span);
+		}
+
+		auto recording = std::make_shared<Recording>(key, video->get_frames(ctx, type, video.span));
+		reg.reading[key] = recording;
+
+		return std::make_unique<ReplayFrameSource>(ctx, video, type, std::move(recording));
+	}
+}
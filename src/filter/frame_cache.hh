@@ -0,0 +1,44 @@
+#pragma once
+
+#include "src/filter/filter.hh"
+#include "src/util.hh"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Keeps the frames of videos that are used more than once in memory so that they are only decoded (and rescaled or
+// resampled) once.
+//
+// Every reader of a cached video replays references to the same frames. While a video is still being read, the
+// reader that is furthest along reads the next frame from the video, so the readers can be read in any order. Once
+// a video has been read completely, it stays cached until the least recently used videos are evicted to keep the
+// cache within `max_bytes()`.
+//
+// The frames of videos that are still being read count towards `max_bytes()` too. If a video doesn't fit even after
+// evicting everything else, it stops being recorded, and its readers that fall behind read the video themselves.
+namespace vcat::filter::frame_cache {
+	constexpr size_t DEFAULT_MAX_BYTES = static_cast<size_t>(1) << 30;
+
+	// Gets or sets the total size of the frame data that is kept (including the videos that are still being read).
+	// This is set by `--frame-cache-size`.
+	size_t max_bytes();
+	void   set_max_bytes(size_t bytes);
+
+	// Describes how much of `max_bytes()` was used at most (for `--alloc-stats`)
+	std::string stats();
+
+	using Key = std::array<uint8_t, Hasher::HASH_SIZE>;
+
+	// Gets the key of the frames of a video with the given output parameters
+	Key key(const FilterContext& ctx, const VFilter& video, StreamType type);
+
+	// Checks if the frames for `key` are cached (or are being read)
+	bool contains(const Key& key);
+
+	// Gets the frames of `video` (which should have the given key). The frames are taken from the cache if
+	// possible. Otherwise, they are added to it, unless they are estimated not to fit in `max_bytes()` (in which case
+	// this is the same as `video->get_frames`).
+	std::unique_ptr<FrameSource> get_frames(FilterContext& ctx, Spanned<const VFilter&> video, StreamType type, const Key& key);
+}
@@ -0,0 +1,440 @@
+#include "src/filter/h264.hh"
+#include "src/constants.hh"
+#include "src/filter/bsf.hh"
+#include "src/filter/error.hh"
+#include "src/filter/util.hh"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+	#include <libavcodec/avcodec.h>
+	#include <libavcodec/codec_id.h>
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/buffer.h>
+	#include <libavutil/mem.h>
+}
+
+namespace vcat::filter::h264 {
+	static constexpr uint8_t NAL_SPS = 7;
+	static constexpr uint8_t NAL_PPS = 8;
+
+	using Nal = std::span<const uint8_t>;
+
+	struct AvccHeader {
+		std::vector<Nal> sps;
+		std::vector<Nal> pps;
+		size_t           end; //< The offset of the bytes after the parameter sets (ie the high profile extension)
+	};
+
+	static std::span<const uint8_t> avcc(const AVCodecParameters *params) {
+		if(
+			params->codec_type     != AVMEDIA_TYPE_VIDEO ||
+			params->codec_id       != AV_CODEC_ID_H264   ||
+			params->extradata_size <  7                  ||
+			params->extradata[0]   != 1
+		) {
+			return {};
+		}
+
+		return std::span(params->extradata, params->extradata_size);
+	}
+
+	static std::optional<AvccHeader> parse_avcc(std::span<const uint8_t> header) {
+		if(header.empty()) {
+			return std::nullopt;
+		}
+
+		AvccHeader parsed;
+		size_t pos = 5;
+
+		// The SPS count is stored in the lower 5 bits, and the PPS count is a whole byte
+		for(auto [count_mask, nals] : {std::pair{0x1f, &parsed.sps}, std::pair{0xff, &parsed.pps}}) {
+			if(pos >= header.size()) {
+				return std::nullopt;
+			}
+
+			const size_t count = header[pos] & count_mask;
+			pos += 1;
+
+			for(size_t i = 0; i < count; i++) {
+				if(pos + 2 > header.size()) {
+					return std::nullopt;
+				}
+
+				const size_t nal_size = (header[pos] << 8) | header[pos + 1];
+				pos += 2;
+
+				if(pos + nal_size > header.size()) {
+					return std::nullopt;
+				}
+
+				nals->push_back(header.subspan(pos, nal_size));
+				pos += nal_size;
+			}
+		}
+
+		parsed.end = pos;
+
+		return parsed;
+	}
+
+	static bool is_annexb(std::span<const uint8_t> data) {
+		return
+			(data.size() >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1) ||
+			(data.size() >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1);
+	}
+
+	// Splits Annex B data into its NAL units
+	static std::vector<Nal> split_annexb(std::span<const uint8_t> data) {
+		std::vector<Nal> nals;
+
+		auto push_nal = [&](size_t start, size_t end) {
+			// Trailing zeroes belong to the next start code
+			while(end > start && data[end - 1] == 0) {
+				end--;
+			}
+
+			if(end > start) {
+				nals.push_back(data.subspan(start, end - start));
+			}
+		};
+
+		std::optional<size_t> start;
+		size_t i = 0;
+
+		while(i + 3 <= data.size()) {
+			if(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+				if(start) {
+					push_nal(*start, i);
+				}
+
+				i += 3;
+				start = i;
+			} else {
+				i++;
+			}
+		}
+
+		if(start) {
+			push_nal(*start, data.size());
+		}
+
+		return nals;
+	}
+
+	static void write_length(std::vector<uint8_t>& output, size_t length, int length_size) {
+		for(int b = length_size - 1; b >= 0; b--) {
+			output.push_back(static_cast<uint8_t>(length >> (8 * b)));
+		}
+	}
+
+	std::optional<int> nal_length_size(const AVCodecParameters *params) {
+		std::span<const uint8_t> header = avcc(params);
+
+		if(header.empty()) {
+			return std::nullopt;
+		}
+
+		return (header[4] & 0x03) + 1;
+	}
+
+	std::optional<std::vector<uint8_t>> parameter_sets(const AVCodecParameters *params) {
+		const std::optional<AvccHeader> header = parse_avcc(avcc(params));
+
+		if(!header) {
+			return std::nullopt;
+		}
+
+		const int length_size = *nal_length_size(params);
+		std::vector<uint8_t> output;
+
+		for(const auto *nals : {&header->sps, &header->pps}) {
+			for(Nal nal : *nals) {
+				write_length(output, nal.size(), length_size);
+				output.insert(output.end(), nal.begin(), nal.end());
+			}
+		}
+
+		return output;
+	}
+
+	// Ranks the profiles that are subsets of each other (constrained baseline, main, and high)
+	static std::optional<int> profile_rank(std::span<const uint8_t> header) {
+		const bool constraint_set1 = header[2] & 0x40;
+
+		switch(header[1]) {
+			case 66:
+				return constraint_set1 ? std::optional(0) : std::nullopt;
+			case 77:
+				return 1;
+			case 100:
+				return 2;
+			default:
+				return std::nullopt;
+		}
+	}
+
+	bool profile_covers(const AVCodecParameters *outer, const AVCodecParameters *inner) {
+		const std::span<const uint8_t> outer_header = avcc(outer);
+		const std::span<const uint8_t> inner_header = avcc(inner);
+
+		if(outer_header.empty() || inner_header.empty()) {
+			return false;
+		}
+
+		if(outer_header[1] == inner_header[1] && outer_header[2] == inner_header[2]) {
+			return true;
+		}
+
+		const std::optional<int> outer_rank = profile_rank(outer_header);
+		const std::optional<int> inner_rank = profile_rank(inner_header);
+
+		return outer_rank && inner_rank && *outer_rank >= *inner_rank;
+	}
+
+	bool can_switch_parameter_sets(const AVCodecParameters *params1, const AVCodecParameters *params2) {
+		const std::optional<int> length_size1 = nal_length_size(params1);
+		const std::optional<int> length_size2 = nal_length_size(params2);
+
+		// The packets are copied as-is, so the length prefixes must be the same size
+		if(!length_size1 || length_size1 != length_size2) {
+			return false;
+		}
+
+		if(!parameter_sets(params1) || !parameter_sets(params2)) {
+			return false;
+		}
+
+		// The output header has the higher of the two profiles, which has to be able to decode both streams
+		if(!profile_covers(params1, params2) && !profile_covers(params2, params1)) {
+			return false;
+		}
+
+		if(!util::display_matrices_equal(util::display_matrix(params1), util::display_matrix(params2))) {
+			return false;
+		}
+
+		return
+			params1->format          == params2->format          &&
+			params1->width           == params2->width           &&
+			params1->height          == params2->height          &&
+			params1->field_order     == params2->field_order     &&
+			params1->color_range     == params2->color_range     &&
+			params1->color_primaries == params2->color_primaries &&
+			params1->color_trc       == params2->color_trc       &&
+			params1->color_space     == params2->color_space     &&
+			params1->chroma_location == params2->chroma_location ;
+	}
+
+	// Converts the Annex B output of a bitstream filter back into the `avcC` form of the original stream
+	//
+	// FFMPEG's `cbs`-based bitstream filters always output Annex B, but the rest of the lossless path (and
+	// concatenation with other clips) relies on length-prefixed NAL units.
+	class AvccPktSource : public PacketSource {
+		public:
+			AvccPktSource(Span span, std::unique_ptr<BsfPktSource>&& src, std::span<const uint8_t> original_avcc)
+				: m_span(span)
+				, m_src(std::move(src))
+				, m_length_size((original_avcc[4] & 0x03) + 1)
+			{
+				AVCodecParameters *par = m_src->codecpar();
+				const std::span<const uint8_t> extradata(par->extradata, par->extradata_size);
+
+				if(!is_annexb(extradata)) {
+					return;
+				}
+
+				std::vector<Nal> sps;
+				std::vector<Nal> pps;
+
+				for(Nal nal : split_annexb(extradata)) {
+					if((nal[0] & 0x1f) == NAL_SPS) {
+						sps.push_back(nal);
+					} else if((nal[0] & 0x1f) == NAL_PPS) {
+						pps.push_back(nal);
+					}
+				}
+
+				const std::optional<AvccHeader> original = parse_avcc(original_avcc);
+				assert(original && !sps.empty() && sps[0].size() >= 4);
+
+				// The profile, compatibility, and level bytes are copied from the new SPS
+				std::vector<uint8_t> header(original_avcc.begin(), original_avcc.begin() + 5);
+				std::copy_n(sps[0].begin() + 1, 3, header.begin() + 1);
+
+				header.push_back(0xe0 | static_cast<uint8_t>(sps.size()));
+				for(Nal nal : sps) {
+					write_length(header, nal.size(), 2);
+					header.insert(header.end(), nal.begin(), nal.end());
+				}
+
+				header.push_back(static_cast<uint8_t>(pps.size()));
+				for(Nal nal : pps) {
+					write_length(header, nal.size(), 2);
+					header.insert(header.end(), nal.begin(), nal.end());
+				}
+
+				header.insert(header.end(), original_avcc.begin() + original->end, original_avcc.end());
+
+				uint8_t *new_extradata = static_cast<uint8_t *>(av_mallocz(header.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+				error::handle_ffmpeg_error(m_span, new_extradata ? 0 : AVERROR(ENOMEM));
+
+				memcpy(new_extradata, header.data(), header.size());
+
+				av_freep(&par->extradata);
+				par->extradata      = new_extradata;
+				par->extradata_size = static_cast<int>(header.size());
+			}
+
+			bool next_pkt(AVPacket **p_packet) {
+				if(!m_src->next_pkt(p_packet)) {
+					return false;
+				}
+
+				AVPacket *const packet = *p_packet;
+				const std::span<const uint8_t> data(packet->data, packet->size);
+
+				if(!is_annexb(data)) {
+					return true;
+				}
+
+				m_buf.clear();
+
+				for(Nal nal : split_annexb(data)) {
+					if(m_length_size < 4 && nal.size() >> (8 * m_length_size) != 0) {
+						error::handle_ffmpeg_error(m_span, AVERROR_INVALIDDATA);
+					}
+
+					write_length(m_buf, nal.size(), m_length_size);
+					m_buf.insert(m_buf.end(), nal.begin(), nal.end());
+				}
+
+				AVBufferRef *buf = av_buffer_alloc(m_buf.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+				error::handle_ffmpeg_error(m_span, buf ? 0 : AVERROR(ENOMEM));
+
+				memcpy(buf->data, m_buf.data(), m_buf.size());
+				memset(buf->data + m_buf.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+				av_buffer_unref(&packet->buf);
+
+				packet->buf  = buf;
+				packet->data = buf->data;
+				packet->size = static_cast<int>(m_buf.size());
+
+				return true;
+			}
+
+			const AVCodecParameters *video_codec() {
+				return m_src->video_codec();
+			}
+
+			int64_t first_pkt_duration() const {
+				return m_src->first_pkt_duration();
+			}
+
+			size_t dts_shift() const {
+				return m_src->dts_shift();
+			}
+
+			TsInfo pts_end_info() const {
+				return m_src->pts_end_info();
+			}
+
+			bool seek(int64_t ts) {
+				return m_src->seek(ts);
+			}
+
+		private:
+			Span                          m_span;
+			std::unique_ptr<BsfPktSource> m_src;
+			int                           m_length_size;
+			std::vector<uint8_t>          m_buf;
+	};
+
+	std::unique_ptr<PacketSource> normalize(Span span, std::unique_ptr<PacketSource>&& src, const VideoParameters& output) {
+		const AVCodecParameters *params = src->video_codec();
+
+		if(params->codec_id != AV_CODEC_ID_H264) {
+			return std::move(src);
+		}
+		const int level = std::max(params->level, util::h264_level(output));
+
+		std::vector<std::string> options;
+
+		if(params->color_primaries == AVCOL_PRI_UNSPECIFIED) {
+			options.push_back(std::format("colour_primaries={}", static_cast<int>(constants::COLOR_PRIMARIES)));
+		}
+
+		if(params->color_trc == AVCOL_TRC_UNSPECIFIED) {
+			options.push_back(std::format("transfer_characteristics={}", static_cast<int>(constants::COLOR_TRANSFER_FUNCTION)));
+		}
+
+		if(params->color_space == AVCOL_SPC_UNSPECIFIED) {
+			options.push_back(std::format("matrix_coefficients={}", static_cast<int>(constants::COLOR_SPACE)));
+		}
+
+		if(params->color_range == AVCOL_RANGE_UNSPECIFIED) {
+			options.push_back(std::format("video_full_range_flag={}", constants::COLOR_RANGE == AVCOL_RANGE_JPEG ? 1 : 0));
+		}
+
+		if(level != params->level) {
+			options.push_back(std::format("level={}", level));
+		}
+
+		// `util::codec_matches_output` only accepts streams with an `avcC` header
+		const std::span<const uint8_t> original_avcc = avcc(params);
+
+		if(options.empty() || !parse_avcc(original_avcc)) {
+			return std::move(src);
+		}
+
+		std::string filter = "h264_metadata=";
+
+		for(size_t i = 0; i < options.size(); i++) {
+			filter += (i == 0 ? "" : ":") + options[i];
+		}
+
+		// `src` owns the original header, so it is copied before `src` is moved into the filter
+		const std::vector<uint8_t> original_header(original_avcc.begin(), original_avcc.end());
+
+		auto bsf = std::make_unique<BsfPktSource>(span, std::move(src), filter.c_str());
+
+		// `h264_metadata` only rewrites the bitstream
+		AVCodecParameters *par_out = bsf->codecpar();
+
+		par_out->color_primaries = constants::COLOR_PRIMARIES;
+		par_out->color_trc       = constants::COLOR_TRANSFER_FUNCTION;
+		par_out->color_space     = constants::COLOR_SPACE;
+		par_out->color_range     = constants::COLOR_RANGE;
+		par_out->level           = level;
+
+		return std::make_unique<AvccPktSource>(span, std::move(bsf), original_header);
+	}
+
+	void prepend_parameter_sets(Span span, AVPacket *packet, const std::vector<uint8_t>& parameter_sets) {
+		const size_t size = parameter_sets.size() + packet->size;
+
+		AVBufferRef *buf = av_buffer_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
+		error::handle_ffmpeg_error(span, buf ? 0 : AVERROR(ENOMEM));
+
+		memcpy(buf->data, parameter_sets.data(), parameter_sets.size());
+		memcpy(buf->data + parameter_sets.size(), packet->data, packet->size);
+		memset(buf->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+		av_buffer_unref(&packet->buf);
+
+		packet->buf  = buf;
+		packet->data = buf->data;
+		packet->size = static_cast<int>(size);
+	}
+}
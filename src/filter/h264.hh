@@ -0,0 +1,41 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/params.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+extern "C" {
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+}
+
+// Helpers for working with H.264 streams in MP4 (`avcC`) form
+namespace vcat::filter::h264 {
+	// Gets the size (in bytes) of the NAL unit length prefixes or `std::nullopt` if `params` doesn't have
+	// an `avcC` header
+	std::optional<int> nal_length_size(const AVCodecParameters *params);
+
+	// Gets the SPS and PPS NAL units of a stream as length-prefixed NAL units (which can be prepended to a
+	// packet). Returns `std::nullopt` if the `avcC` header is malformed.
+	std::optional<std::vector<uint8_t>> parameter_sets(const AVCodecParameters *params);
+
+	// Checks if a decoder for the profile of `outer` can decode `inner` (ie if the profiles are the same or if `inner` has
+	// a lower profile out of constrained baseline, main, and high)
+	bool profile_covers(const AVCodecParameters *outer, const AVCodecParameters *inner);
+
+	// Checks if two H.264 streams can be concatenated by switching parameter sets in-band (see
+	// `h264::prepend_parameter_sets`), even though their extradata differs.
+	bool can_switch_parameter_sets(const AVCodecParameters *params1, const AVCodecParameters *params2);
+
+	// Prepends length-prefixed parameter sets to the data of `packet`
+	void prepend_parameter_sets(Span span, AVPacket *packet, const std::vector<uint8_t>& parameter_sets);
+
+	// Rewrites the headers of an H.264 stream that `util::codec_matches_output` accepted so that they match the ones
+	// produced by our encoder as closely as possible: unspecified color tags are set to the output colors, and
+	// the level is raised to the encoder's level. Returns `src` if nothing needs to change.
+	std::unique_ptr<PacketSource> normalize(Span span, std::unique_ptr<PacketSource>&& src, const VideoParameters& output);
+}
@@ -10,6 +10,7 @@ namespace vcat::filter {
 		hasher.add(height);
 		hasher.add(fixed_fps);
 		hasher.add((int64_t) fps);
+		hasher.add(static_cast<uint8_t>(codec));
 
 		hasher.add(static_cast<uint64_t>(hasher.pos() - start));
 	}
@@ -15,6 +15,8 @@ namespace vcat::filter {
 			bool fixed_fps;
 
 			double fps;
+
+			shared::VideoCodec codec; //< The output codec (this is never `shared::automatic`)
 	};
 
 	class AudioParameters {
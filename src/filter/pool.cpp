@@ -0,0 +1,379 @@
+#include "src/filter/pool.hh"
+#include "src/constants.hh"
+#include "src/filter/params.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+	#include <libavcodec/avcodec.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/buffer.h>
+	#include <libavutil/error.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/imgutils.h>
+	#include <libavutil/pixdesc.h>
+	#include <libavutil/samplefmt.h>
+}
+
+namespace vcat::filter::pool {
+	// The maximum number of unused `AVFrame`s/`AVPacket`s that are kept around
+	static constexpr size_t MAX_FREE = 64;
+
+	// The maximum number of distinct buffer sizes that are pooled
+	static constexpr size_t MAX_BUFFER_POOLS = 32;
+
+	// The linesize alignment used for frames allocated by native filters
+	static constexpr int STRIDE_ALIGN = 64;
+
+	// Extra bytes after every video plane (some SIMD code reads past the end of a line)
+	static constexpr size_t VIDEO_PADDING = 16 + STRIDE_ALIGN - 1;
+
+	namespace {
+		struct Counters {
+			std::atomic<size_t> frame_allocs;
+			std::atomic<size_t> frame_reuses;
+			std::atomic<size_t> packet_allocs;
+			std::atomic<size_t> packet_reuses;
+			std::atomic<size_t> buffer_allocs;
+			std::atomic<size_t> buffer_gets;
+			std::atomic<size_t> unpooled_buffers;
+		};
+
+		// NOTE: decoders may request buffers from their own threads, so all of this is behind a mutex
+		struct Registry {
+			std::mutex mutex;
+
+			std::vector<AVFrame *>  frames;
+			std::vector<AVPacket *> packets;
+			std::vector<std::pair<size_t, AVBufferPool *>> buffer_pools;
+
+			~Registry() {
+				for(AVFrame *frame : frames) {
+					av_frame_free(&frame);
+				}
+
+				for(AVPacket *packet : packets) {
+					av_packet_free(&packet);
+				}
+
+				// The pools are actually freed once all of their buffers are returned
+				for(auto& [_, pool] : buffer_pools) {
+					av_buffer_pool_uninit(&pool);
+				}
+			}
+		};
+	}
+
+	static Counters s_counters;
+
+	static Registry& registry() {
+		static Registry registry;
+		return registry;
+	}
+
+	static AVBufferRef *counted_alloc(size_t size) {
+		s_counters.buffer_allocs += 1;
+		return av_buffer_allocz(size);
+	}
+
+	// Gets a buffer of `size` bytes from the buffer pool for that size
+	static AVBufferRef *pooled_buffer(size_t size) {
+		Registry& reg = registry();
+		AVBufferPool *pool = nullptr;
+
+		{
+			std::lock_guard lock(reg.mutex);
+
+			auto it = std::ranges::find(reg.buffer_pools, size, &std::pair<size_t, AVBufferPool *>::first);
+
+			if(it != reg.buffer_pools.end()) {
+				pool = it->second;
+			} else if(reg.buffer_pools.size() < MAX_BUFFER_POOLS) {
+				pool = av_buffer_pool_init(size, counted_alloc);
+
+				if(pool) {
+					reg.buffer_pools.emplace_back(size, pool);
+				}
+			}
+		}
+
+		if(!pool) {
+			s_counters.unpooled_buffers += 1;
+			return av_buffer_alloc(size);
+		}
+
+		s_counters.buffer_gets += 1;
+		return av_buffer_pool_get(pool);
+	}
+
+	// Releases the buffers attached by `attach_buffers` after a failed allocation
+	static int release_buffers(AVFrame *frame, int error) {
+		for(size_t i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+			av_buffer_unref(&frame->buf[i]);
+			frame->data[i] = nullptr;
+			frame->linesize[i] = 0;
+		}
+
+		frame->extended_data = nullptr;
+
+		return error;
+	}
+
+	// Attaches a pooled buffer to the first `num_planes` planes of `frame`
+	static int attach_buffers(AVFrame *frame, const size_t *plane_sizes, int num_planes) {
+		for(int i = 0; i < num_planes; i++) {
+			frame->buf[i] = pooled_buffer(plane_sizes[i]);
+
+			if(!frame->buf[i]) {
+				return release_buffers(frame, AVERROR(ENOMEM));
+			}
+
+			frame->data[i] = frame->buf[i]->data;
+		}
+
+		frame->extended_data = frame->data;
+
+		return 0;
+	}
+
+	// Allocates a video frame whose dimensions have been padded to `width` by `height`. Like in FFMPEG's default
+	// allocator, the width is increased until every linesize is a multiple of the corresponding `linesize_align`.
+	static int alloc_video(AVFrame *frame, int width, int height, const int *linesize_align) {
+		const AVPixelFormat format = static_cast<AVPixelFormat>(frame->format);
+
+		int linesize[4];
+		bool unaligned;
+
+		do {
+			int res = av_image_fill_linesizes(linesize, format, width);
+			if(res < 0) {
+				return res;
+			}
+
+			width += width & ~(width - 1);
+
+			unaligned = false;
+			for(size_t i = 0; i < 4; i++) {
+				unaligned |= linesize[i] % linesize_align[i] != 0;
+			}
+		} while(unaligned);
+
+		ptrdiff_t linesize_ptrdiff[4];
+		std::copy_n(linesize, 4, linesize_ptrdiff);
+
+		size_t plane_sizes[4];
+		int res = av_image_fill_plane_sizes(plane_sizes, format, height, linesize_ptrdiff);
+		if(res < 0) {
+			return res;
+		}
+
+		int num_planes = 0;
+		while(num_planes < 4 && plane_sizes[num_planes] > 0) {
+			plane_sizes[num_planes] += VIDEO_PADDING;
+			frame->linesize[num_planes] = linesize[num_planes];
+
+			num_planes++;
+		}
+
+		return attach_buffers(frame, plane_sizes, num_planes);
+	}
+
+	static int alloc_audio(AVFrame *frame) {
+		const AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+		const int channels = frame->ch_layout.nb_channels;
+		const int num_planes = av_sample_fmt_is_planar(format) ? channels : 1;
+
+		if(num_planes > AV_NUM_DATA_POINTERS) {
+			s_counters.unpooled_buffers += 1;
+			return av_frame_get_buffer(frame, 0);
+		}
+
+		// The last frame of a stream is usually shorter, but we don't want to create a new pool for it
+		const int capacity = std::max(frame->nb_samples, static_cast<int>(constants::SAMPLES_PER_FRAME));
+
+		int linesize;
+		int res = av_samples_get_buffer_size(&linesize, channels, capacity, format, 0);
+		if(res < 0) {
+			return res;
+		}
+
+		frame->linesize[0] = linesize;
+
+		size_t plane_sizes[AV_NUM_DATA_POINTERS];
+		std::fill_n(plane_sizes, num_planes, static_cast<size_t>(linesize));
+
+		return attach_buffers(frame, plane_sizes, num_planes);
+	}
+
+	static int decoder_get_buffer(AVCodecContext *decoder, AVFrame *frame, int flags) {
+		const VideoParameters *output = static_cast<const VideoParameters *>(decoder->opaque);
+
+		if(
+			!(decoder->codec->capabilities & AV_CODEC_CAP_DR1) ||
+			decoder->codec_type != AVMEDIA_TYPE_VIDEO          ||
+			frame->format != constants::PIXEL_FORMAT           ||
+			frame->width  != output->width                     ||
+			frame->height != output->height
+		) {
+			s_counters.unpooled_buffers += 1;
+			return avcodec_default_get_buffer2(decoder, frame, flags);
+		}
+
+		int width  = frame->width;
+		int height = frame->height;
+		int linesize_align[AV_NUM_DATA_POINTERS];
+
+		avcodec_align_dimensions2(decoder, &width, &height, linesize_align);
+
+		return alloc_video(frame, width, height, linesize_align);
+	}
+
+	AVFrame *alloc_frame() {
+		Registry& reg = registry();
+
+		{
+			std::lock_guard lock(reg.mutex);
+
+			if(!reg.frames.empty()) {
+				AVFrame *frame = reg.frames.back();
+				reg.frames.pop_back();
+
+				s_counters.frame_reuses += 1;
+				return frame;
+			}
+		}
+
+		AVFrame *frame = av_frame_alloc();
+		if(frame) {
+			s_counters.frame_allocs += 1;
+		}
+
+		return frame;
+	}
+
+	void free_frame(AVFrame **frame) {
+		if(!*frame) {
+			return;
+		}
+
+		av_frame_unref(*frame);
+
+		Registry& reg = registry();
+
+		{
+			std::lock_guard lock(reg.mutex);
+
+			if(reg.frames.size() < MAX_FREE) {
+				reg.frames.push_back(*frame);
+				*frame = nullptr;
+				return;
+			}
+		}
+
+		av_frame_free(frame);
+	}
+
+	AVPacket *alloc_packet() {
+		Registry& reg = registry();
+
+		{
+			std::lock_guard lock(reg.mutex);
+
+			if(!reg.packets.empty()) {
+				AVPacket *packet = reg.packets.back();
+				reg.packets.pop_back();
+
+				s_counters.packet_reuses += 1;
+				return packet;
+			}
+		}
+
+		AVPacket *packet = av_packet_alloc();
+		if(packet) {
+			s_counters.packet_allocs += 1;
+		}
+
+		return packet;
+	}
+
+	void free_packet(AVPacket **packet) {
+		if(!*packet) {
+			return;
+		}
+
+		av_packet_unref(*packet);
+
+		Registry& reg = registry();
+
+		{
+			std::lock_guard lock(reg.mutex);
+
+			if(reg.packets.size() < MAX_FREE) {
+				reg.packets.push_back(*packet);
+				*packet = nullptr;
+				return;
+			}
+		}
+
+		av_packet_free(packet);
+	}
+
+	int get_buffer(AVFrame *frame) {
+		if(frame->width > 0 && frame->height > 0) {
+			const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+
+			if(!desc || desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)) {
+				s_counters.unpooled_buffers += 1;
+				return av_frame_get_buffer(frame, 0);
+			}
+
+			const int linesize_align[4] = {STRIDE_ALIGN, STRIDE_ALIGN, STRIDE_ALIGN, STRIDE_ALIGN};
+
+			return alloc_video(frame, frame->width, frame->height, linesize_align);
+		}
+
+		if(frame->nb_samples > 0 && frame->ch_layout.nb_channels > 0) {
+			return alloc_audio(frame);
+		}
+
+		return AVERROR(EINVAL);
+	}
+
+	void use_for_decoder(AVCodecContext *decoder, const VideoParameters& output) {
+		decoder->opaque = const_cast<VideoParameters *>(&output);
+		decoder->get_buffer2 = decoder_get_buffer;
+	}
+
+	Stats stats() {
+		const size_t buffer_allocs = s_counters.buffer_allocs;
+		const size_t buffer_gets   = s_counters.buffer_gets;
+
+		return Stats {
+			.frame_allocs     = s_counters.frame_allocs,
+			.frame_reuses     = s_counters.frame_reuses,
+			.packet_allocs    = s_counters.packet_allocs,
+			.packet_reuses    = s_counters.packet_reuses,
+			.buffer_allocs    = buffer_allocs,
+			.buffer_reuses    = buffer_gets - std::min(buffer_gets, buffer_allocs),
+			.unpooled_buffers = s_counters.unpooled_buffers,
+		};
+	}
+
+	std::string Stats::to_string() const {
+		return std::format(
+			"frames:  {} allocated, {} reused\n"
+			"packets: {} allocated, {} reused\n"
+			"buffers: {} allocated, {} reused, {} unpooled\n",
+			frame_allocs, frame_reuses,
+			packet_allocs, packet_reuses,
+			buffer_allocs, buffer_reuses, unpooled_buffers
+		);
+	}
+}
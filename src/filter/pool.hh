@@ -0,0 +1,47 @@
+#pragma once
+
+#include "src/filter/params.hh"
+#include <cstddef>
+#include <string>
+
+extern "C" {
+	#include <libavcodec/avcodec.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/frame.h>
+}
+
+// Recycles `AVFrame`s, `AVPacket`s, and their data buffers across the pipeline.
+//
+// These functions behave like their FFMPEG counterparts (eg `pool::alloc_frame` returns `nullptr` on failure),
+// so they can be used as drop-in replacements.
+namespace vcat::filter::pool {
+	struct Stats {
+		size_t frame_allocs;     //< The number of `AVFrame`s allocated
+		size_t frame_reuses;     //< The number of times that an `AVFrame` was recycled
+		size_t packet_allocs;    //< The number of `AVPacket`s allocated
+		size_t packet_reuses;    //< The number of times that an `AVPacket` was recycled
+		size_t buffer_allocs;    //< The number of data buffers allocated by a buffer pool
+		size_t buffer_reuses;    //< The number of times that a buffer pool recycled a data buffer
+		size_t unpooled_buffers; //< The number of frames whose data could not be allocated from a buffer pool
+
+		std::string to_string() const;
+	};
+
+	AVFrame *alloc_frame();
+	void free_frame(AVFrame **frame);
+
+	AVPacket *alloc_packet();
+	void free_packet(AVPacket **packet);
+
+	// Allocates the data of `frame` from a buffer pool (like `av_frame_get_buffer` with default alignment)
+	//
+	// The format and dimensions (or sample count and channel layout) of `frame` must already be set.
+	int get_buffer(AVFrame *frame);
+
+	// Makes `decoder` allocate frames with the output format and dimensions from a buffer pool
+	//
+	// NOTE: this must be called before `avcodec_open2`, and `output` must outlive `decoder`.
+	void use_for_decoder(AVCodecContext *decoder, const VideoParameters& output);
+
+	Stats stats();
+}
@@ -0,0 +1,198 @@
+#include "src/filter/repeat.hh"
+#include "src/filter/concat.hh"
+#include "src/filter/error.hh"
+#include "src/filter/frame_cache.hh"
+#include "src/util.hh"
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/error.h>
+}
+
+namespace vcat::filter {
+	Repeat::Repeat(Spanned<const VFilter&> video, size_t count)
+		: m_video(video)
+		, m_count(count)
+	{}
+
+	void Repeat::hash(Hasher& hasher) const {
+		hasher.add("_repeat_");
+		const size_t start = hasher.pos();
+
+		m_video->hash(hasher);
+		hasher.add((uint64_t) m_count);
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Repeat::to_string() const {
+		std::stringstream s;
+
+		s << "Repeat(\n"
+			<< indent(m_video->to_string()) << ",\n"
+			<< indent(std::to_string(m_count))
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string Repeat::type_name() const {
+		return "Repeat";
+	}
+
+	void Repeat::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		std::map<AVCodecID, size_t> video_counts;
+		m_video->count_codecs(video_counts);
+
+		for(const auto& [codec, count] : video_counts) {
+			counts[codec] += count * m_count;
+		}
+	}
+
+	std::optional<int64_t> Repeat::duration(FilterContext& ctx, Span) const {
+		const std::optional<int64_t> duration = m_video->duration(ctx, m_video.span);
+
+		if(!duration) {
+			return std::nullopt;
+		}
+
+		return *duration * static_cast<int64_t>(m_count);
+	}
+
+	std::unique_ptr<PacketSource> Repeat::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(!ctx.allow_preroll) {
+			return std::make_unique<RepeatPktSource>(span, m_video->get_pkts(ctx, type, m_video.span), m_count);
+		}
+
+		// Pre-roll can't be repeated, so the first repetition is read on its own
+		std::vector<std::unique_ptr<PacketSource>> parts;
+		parts.push_back(m_video->get_pkts(ctx, type, m_video.span));
+
+		if(m_count > 1) {
+			ctx.allow_preroll = false;
+			parts.push_back(std::make_unique<RepeatPktSource>(span, m_video->get_pkts(ctx, type, m_video.span), m_count - 1));
+			ctx.allow_preroll = true;
+		}
+
+		if(parts.size() == 1) {
+			return std::move(parts[0]);
+		}
+
+		return std::make_unique<ConcatPktSource>(span, std::move(parts), type);
+	}
+
+	std::unique_ptr<FrameSource> Repeat::get_frames(FilterContext& ctx, StreamType type, Span) const {
+		return std::make_unique<RepeatFrameSource>(ctx, type, m_video, m_count);
+	}
+
+	RepeatPktSource::RepeatPktSource(Span span, std::unique_ptr<PacketSource>&& src, size_t count)
+		: m_span(span)
+		, m_src(std::move(src))
+		, m_count(count)
+		, m_rep(0)
+		, m_audio()
+	{
+		const TsInfo end = m_src->pts_end_info();
+		m_length = end.ts + end.duration;
+	}
+
+	bool RepeatPktSource::next_pkt(AVPacket **p_packet) {
+		for(;;) {
+			while(!m_src->next_pkt(p_packet)) {
+				if(m_rep + 1 >= m_count) {
+					return false;
+				}
+
+				m_rep++;
+
+				error::handle_ffmpeg_error(m_span,
+					m_src->seek(std::numeric_limits<int64_t>::min()) ? 0 : AVERROR(ENOSYS)
+				);
+			}
+
+			AVPacket *packet = *p_packet;
+			const int64_t offset = m_length * static_cast<int64_t>(m_rep);
+
+			packet->pts += offset;
+			packet->dts += offset;
+
+			// The audio of every repetition continues where the previous one ended (like in `ConcatPktSource`)
+			if(m_src->video_codec()->codec_type == AVMEDIA_TYPE_AUDIO && !m_audio.place(packet)) {
+				av_packet_unref(packet);
+				continue;
+			}
+
+			return true;
+		}
+	}
+
+	const AVCodecParameters *RepeatPktSource::video_codec() {
+		return m_src->video_codec();
+	}
+
+	int64_t RepeatPktSource::first_pkt_duration() const {
+		return m_src->first_pkt_duration();
+	}
+
+	size_t RepeatPktSource::dts_shift() const {
+		return m_src->dts_shift();
+	}
+
+	TsInfo RepeatPktSource::pts_end_info() const {
+		const TsInfo end = m_src->pts_end_info();
+
+		return TsInfo {
+			.ts       = end.ts + m_length * static_cast<int64_t>(m_count - 1),
+			.duration = end.duration,
+		};
+	}
+
+	bool RepeatPktSource::seek(int64_t ts) {
+		const int64_t rep = m_length > 0 ? std::clamp(ts / m_length, static_cast<int64_t>(0), static_cast<int64_t>(m_count - 1)) : 0;
+
+		if(!m_src->seek(ts - rep * m_length)) {
+			return false;
+		}
+
+		m_rep = static_cast<size_t>(rep);
+		m_audio.reset();
+
+		return true;
+	}
+
+	RepeatFrameSource::RepeatFrameSource(FilterContext& ctx, StreamType type, Spanned<const VFilter&> video, size_t count)
+		: m_ctx(ctx)
+		, m_type(type)
+		, m_video(video)
+		, m_key(frame_cache::key(ctx, *video, type))
+		, m_src(frame_cache::get_frames(ctx, video, type, m_key))
+		, m_count(count)
+		, m_rep(0)
+		, m_offset(0)
+		, m_end(0)
+	{}
+
+	bool RepeatFrameSource::next_frame(AVFrame **frame) {
+		while(!m_src->next_frame(frame)) {
+			if(m_rep + 1 >= m_count) {
+				return false;
+			}
+
+			m_rep++;
+
+			if(!m_src->seek(std::numeric_limits<int64_t>::min())) {
+				m_src = frame_cache::get_frames(m_ctx, m_video, m_type, m_key);
+			}
+
+			m_offset = m_end;
+		}
+
+		(*frame)->pts += m_offset;
+		m_end = std::max(m_end, (*frame)->pts + (*frame)->duration);
+
+		return true;
+	}
+}
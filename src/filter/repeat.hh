@@ -0,0 +1,111 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/audio_fit.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/frame_cache.hh"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+
+extern "C" {
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/frame.h>
+}
+
+namespace vcat::filter {
+	// Plays a video `count` times in a row (ie from `repeat`). The video is only opened once, and its packets are
+	// replayed for every repetition.
+	//
+	// NOTE: like `ERepeatedList`, this is hashed by its video and count, so it doesn't share cache entries with a
+	// `Concat` of the same video `count` times.
+	class Repeat : public VFilter {
+		public:
+			Repeat() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			inline Spanned<const VFilter&> video() const {
+				return m_video;
+			}
+
+			inline size_t count() const {
+				return m_count;
+			}
+
+			// NOTE: `count` must be at least 1
+			Repeat(Spanned<const VFilter&> video, size_t count);
+
+		private:
+			Spanned<const VFilter&> m_video;
+			size_t                  m_count;
+	};
+
+	static_assert(!std::is_abstract<Repeat>());
+
+	// Plays the packets of a source `count` times in a row by seeking back to its start. Every repetition is
+	// shifted by the length of the source (see `PacketSource::pts_end_info`).
+	//
+	// NOTE: the source must be able to seek, and `count` must be at least 1
+	class RepeatPktSource : public PacketSource {
+		public:
+			RepeatPktSource() = delete;
+			RepeatPktSource(RepeatPktSource&) = delete;
+
+			RepeatPktSource(Span span, std::unique_ptr<PacketSource>&& src, size_t count);
+
+			bool next_pkt(AVPacket **p_packet);
+			const AVCodecParameters *video_codec();
+			int64_t first_pkt_duration() const;
+			size_t  dts_shift() const;
+			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+		private:
+			Span                          m_span;
+			std::unique_ptr<PacketSource> m_src;
+			size_t                        m_count;
+			size_t                        m_rep;    //< The index of the current repetition
+			int64_t                       m_length; //< The length of one repetition
+			AudioSplicer                  m_audio;
+	};
+
+	static_assert(!std::is_abstract<RepeatPktSource>());
+
+	// Plays the frames of a video `count` times in a row. Every repetition starts where the previous one ended.
+	//
+	// The frames are kept in `frame_cache` if they fit, so the video is only decoded once. Otherwise, it is read
+	// from the start again by seeking if possible, or opened again for every repetition.
+	class RepeatFrameSource : public FrameSource {
+		public:
+			RepeatFrameSource() = delete;
+			RepeatFrameSource(RepeatFrameSource&) = delete;
+
+			// NOTE: `ctx` must outlive this
+			RepeatFrameSource(FilterContext& ctx, StreamType type, Spanned<const VFilter&> video, size_t count);
+
+			bool next_frame(AVFrame **frame);
+
+		private:
+			FilterContext&               m_ctx;
+			StreamType                   m_type;
+			Spanned<const VFilter&>      m_video;
+			frame_cache::Key             m_key;
+			std::unique_ptr<FrameSource> m_src;
+			size_t                       m_count;
+			size_t                       m_rep;    //< The index of the current repetition
+			int64_t                      m_offset; //< How much the pts of the current repetition are offset
+			int64_t                      m_end;    //< The end of the latest frame so far
+	};
+
+	static_assert(!std::is_abstract<RepeatFrameSource>());
+}
@@ -0,0 +1,215 @@
+#include "src/filter/speed.hh"
+#include "src/constants.hh"
+#include "src/filter/h264.hh"
+#include "src/util.hh"
+#include <format>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/mathematics.h>
+}
+
+namespace vcat::filter {
+	// Divides a timestamp by the speed factor
+	static int64_t retime(int64_t ts, AVRational factor) {
+		return av_rescale_rnd(ts, factor.den, factor.num, static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+	}
+
+	// `atempo` only accepts factors between 0.5 and 100, so larger changes are split across several of them
+	static std::string atempo_chain(double factor) {
+		std::string filter;
+
+		while(factor > 100.0) {
+			filter += "atempo=100,";
+			factor /= 100.0;
+		}
+
+		while(factor < 0.5) {
+			filter += "atempo=0.5,";
+			factor /= 0.5;
+		}
+
+		filter += std::format("atempo={}", factor);
+
+		return filter;
+	}
+
+	Speed::Speed(Spanned<const VFilter&> video, AVRational factor) : m_video(video), m_factor(factor) {}
+
+	void Speed::hash(Hasher& hasher) const {
+		hasher.add("_speed_");
+		const size_t start = hasher.pos();
+
+		m_video->hash(hasher);
+
+		hasher.add(static_cast<int64_t>(m_factor.num));
+		hasher.add(static_cast<int64_t>(m_factor.den));
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Speed::to_string() const {
+		std::stringstream s;
+
+		s << "Speed(\n"
+			<< indent(m_video->to_string()) << ",\n"
+			<< indent(std::format("{}/{}", m_factor.num, m_factor.den))
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string Speed::type_name() const {
+		return "Speed";
+	}
+
+	void Speed::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		m_video->count_codecs(counts);
+	}
+
+	std::unique_ptr<FilterContext> Speed::source_context(const FilterContext& ctx) const {
+		auto source_ctx = std::make_unique<FilterContext>(VideoParameters(ctx.vparams), AudioParameters(ctx.aparams));
+
+		source_ctx->vparams.fps   = ctx.vparams.fps / av_q2d(m_factor);
+		source_ctx->allow_preroll = ctx.allow_preroll;
+
+		return source_ctx;
+	}
+
+	std::optional<int64_t> Speed::duration(FilterContext& ctx, Span) const {
+		const std::optional<int64_t> video_duration = m_video->duration(*source_context(ctx), m_video.span);
+
+		if(!video_duration) {
+			return std::nullopt;
+		}
+
+		return retime(*video_duration, m_factor);
+	}
+
+	TimeRange Speed::source_range(const TimeRange& range) const {
+		const auto unretime = [this](int64_t ts) {
+			return av_rescale_rnd(ts, m_factor.num, m_factor.den, static_cast<AVRounding>(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+		};
+
+		return TimeRange {
+			.start = unretime(range.start),
+			.end   = range.end ? std::optional(unretime(*range.end)) : std::nullopt,
+		};
+	}
+
+	std::unique_ptr<PacketSource> Speed::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Audio) {
+			return encode(ctx, span, *this, type);
+		}
+
+		std::unique_ptr<FilterContext> source_ctx = source_context(ctx);
+		std::unique_ptr<PacketSource> pkts = m_video->get_pkts(*source_ctx, type, m_video.span);
+
+		auto retimed = std::make_unique<RetimePktSource>(std::move(source_ctx), std::move(pkts), m_factor);
+
+		// The source's H.264 level may be too low for the new framerate
+		return h264::normalize(span, std::move(retimed), ctx.vparams);
+	}
+
+	std::unique_ptr<FrameSource> Speed::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Video) {
+			std::unique_ptr<FilterContext> source_ctx = source_context(ctx);
+			std::unique_ptr<FrameSource> frames = m_video->get_frames(*source_ctx, type, m_video.span);
+
+			return std::make_unique<RetimeFrameSource>(std::move(source_ctx), std::move(frames), m_factor);
+		}
+
+		std::string filter = atempo_chain(av_q2d(m_factor));
+
+		// The stretched audio is cut/padded to the exact length of the video so that it stays in sync
+		if(const std::optional<int64_t> length = duration(ctx, span)) {
+			const int64_t end_sample = av_rescale_q(*length, constants::TIMEBASE, AVRational {1, ctx.aparams.sample_rate});
+
+			filter += std::format(",atrim=end_sample={},apad=whole_len={}", end_sample, end_sample);
+		}
+
+		std::vector<std::unique_ptr<FrameSource>> sources;
+		sources.push_back(m_video->get_frames(ctx, type, m_video.span));
+
+		const StreamType input_types[] = {type};
+
+		return std::make_unique<FFMpegFilter>(span, std::move(sources), filter.c_str(), ctx, input_types, type);
+	}
+
+	RetimePktSource::RetimePktSource(std::unique_ptr<FilterContext>&& ctx, std::unique_ptr<PacketSource>&& src, AVRational factor)
+		: m_ctx(std::move(ctx))
+		, m_src(std::move(src))
+		, m_factor(factor)
+	{}
+
+	bool RetimePktSource::next_pkt(AVPacket **p_packet) {
+		if(!m_src->next_pkt(p_packet)) {
+			return false;
+		}
+
+		AVPacket *packet = *p_packet;
+
+		// The duration is taken from the retimed ends so that consecutive packets still line up exactly
+		const int64_t end = retime(packet->pts + packet->duration, m_factor);
+
+		packet->pts      = retime(packet->pts, m_factor);
+		packet->dts      = retime(packet->dts, m_factor);
+		packet->duration = end - packet->pts;
+
+		return true;
+	}
+
+	const AVCodecParameters *RetimePktSource::video_codec() {
+		return m_src->video_codec();
+	}
+
+	int64_t RetimePktSource::first_pkt_duration() const {
+		return retime(m_src->first_pkt_duration(), m_factor);
+	}
+
+	size_t RetimePktSource::dts_shift() const {
+		return m_src->dts_shift();
+	}
+
+	TsInfo RetimePktSource::pts_end_info() const {
+		const TsInfo info = m_src->pts_end_info();
+		const int64_t ts = retime(info.ts, m_factor);
+
+		return TsInfo {
+			.ts       = ts,
+			.duration = retime(info.ts + info.duration, m_factor) - ts,
+		};
+	}
+
+	bool RetimePktSource::seek(int64_t ts) {
+		return m_src->seek(av_rescale_rnd(ts, m_factor.num, m_factor.den, static_cast<AVRounding>(AV_ROUND_DOWN | AV_ROUND_PASS_MINMAX)));
+	}
+
+	RetimeFrameSource::RetimeFrameSource(std::unique_ptr<FilterContext>&& ctx, std::unique_ptr<FrameSource>&& src, AVRational factor)
+		: m_ctx(std::move(ctx))
+		, m_src(std::move(src))
+		, m_factor(factor)
+	{}
+
+	bool RetimeFrameSource::next_frame(AVFrame **p_frame) {
+		if(!m_src->next_frame(p_frame)) {
+			return false;
+		}
+
+		AVFrame *frame = *p_frame;
+
+		const int64_t end = retime(frame->pts + frame->duration, m_factor);
+
+		frame->pts      = retime(frame->pts, m_factor);
+		frame->pkt_dts  = retime(frame->pkt_dts, m_factor);
+		frame->duration = end - frame->pts;
+
+		return true;
+	}
+
+	bool RetimeFrameSource::seek(int64_t ts) {
+		return m_src->seek(av_rescale_rnd(ts, m_factor.num, m_factor.den, static_cast<AVRounding>(AV_ROUND_DOWN | AV_ROUND_PASS_MINMAX)));
+	}
+}
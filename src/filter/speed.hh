@@ -0,0 +1,101 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+extern "C" {
+	#include <libavcodec/codec_par.h>
+	#include <libavcodec/packet.h>
+	#include <libavutil/frame.h>
+	#include <libavutil/rational.h>
+}
+
+namespace vcat::filter {
+	// Speeds up (or slows down) a video by `factor`.
+	//
+	// The video is never decoded for this: its packets are just retimed. The source is read with the framerate
+	// divided by `factor` so that the retimed packets have the output framerate. The audio is time-stretched
+	// (without changing its pitch) and re-encoded.
+	class Speed : public VFilter {
+		public:
+			Speed() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			inline Spanned<const VFilter&> video() const {
+				return m_video;
+			}
+
+			inline AVRational factor() const {
+				return m_factor;
+			}
+
+			// Maps a range of the output onto the source video
+			TimeRange source_range(const TimeRange& range) const;
+
+			// NOTE: `factor` must be positive
+			Speed(Spanned<const VFilter&> video, AVRational factor);
+
+		private:
+			// Creates the context that the source video is read with
+			std::unique_ptr<FilterContext> source_context(const FilterContext& ctx) const;
+
+			Spanned<const VFilter&> m_video;
+			AVRational              m_factor;
+	};
+
+	static_assert(!std::is_abstract<Speed>());
+
+	// Divides the timestamps of packets by `factor`. The order of the packets (and so `dts_shift`) is unchanged.
+	class RetimePktSource : public PacketSource {
+		public:
+			RetimePktSource() = delete;
+			RetimePktSource(RetimePktSource&) = delete;
+
+			// NOTE: `ctx` is the context that `src` was created with (it is kept alive for as long as `src`)
+			RetimePktSource(std::unique_ptr<FilterContext>&& ctx, std::unique_ptr<PacketSource>&& src, AVRational factor);
+
+			bool next_pkt(AVPacket **p_packet);
+			const AVCodecParameters *video_codec();
+			int64_t first_pkt_duration() const;
+			size_t  dts_shift() const;
+			TsInfo  pts_end_info() const;
+			bool    seek(int64_t ts);
+
+		private:
+			std::unique_ptr<FilterContext> m_ctx;
+			std::unique_ptr<PacketSource>  m_src;
+			AVRational                     m_factor;
+	};
+
+	static_assert(!std::is_abstract<RetimePktSource>());
+
+	// Divides the timestamps of frames by `factor`
+	class RetimeFrameSource : public FrameSource {
+		public:
+			RetimeFrameSource() = delete;
+			RetimeFrameSource(RetimeFrameSource&) = delete;
+
+			// NOTE: `ctx` is the context that `src` was created with (it is kept alive for as long as `src`)
+			RetimeFrameSource(std::unique_ptr<FilterContext>&& ctx, std::unique_ptr<FrameSource>&& src, AVRational factor);
+
+			bool next_frame(AVFrame **frame);
+			bool seek(int64_t ts);
+
+		private:
+			std::unique_ptr<FilterContext> m_ctx;
+			std::unique_ptr<FrameSource>   m_src;
+			AVRational                     m_factor;
+	};
+
+	static_assert(!std::is_abstract<RetimeFrameSource>());
+}
@@ -0,0 +1,221 @@
+#include "src/filter/still.hh"
+#include "src/constants.hh"
+#include "src/filter/blank.hh"
+#include "src/filter/concat.hh"
+#include "src/filter/error.hh"
+#include "src/filter/pool.hh"
+#include "src/filter/repeat.hh"
+#include "src/filter/util.hh"
+#include "src/util.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <format>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+	#include <libavutil/channel_layout.h>
+	#include <libavutil/error.h>
+	#include <libavutil/imgutils.h>
+	#include <libavutil/mathematics.h>
+	#include <libavutil/samplefmt.h>
+}
+
+namespace vcat::filter {
+	Still::Still(Spanned<const VideoFile&> image, int64_t duration) : m_image(image), m_duration(duration) {}
+
+	void Still::hash(Hasher& hasher) const {
+		hasher.add("_still_");
+		const size_t start = hasher.pos();
+
+		m_image->hash(hasher);
+
+		hasher.add(m_duration);
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Still::to_string() const {
+		std::stringstream s;
+
+		s << "Still(\n"
+			<< indent(m_image->to_string()) << ",\n"
+			<< indent(std::format("{}", av_q2d(constants::TIMEBASE) * m_duration))
+			<< "\n)";
+
+		return s.str();
+	}
+
+	std::string Still::type_name() const {
+		return "Still";
+	}
+
+	std::optional<int64_t> Still::duration(FilterContext&, Span) const {
+		return m_duration;
+	}
+
+	std::unique_ptr<PacketSource> Still::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Audio) {
+			return Blank(m_duration).get_pkts(ctx, type, span);
+		}
+
+		return repeat_gop(ctx, span, m_duration, [&](int64_t duration) {
+			return encode(ctx, span, Still(m_image, duration), type);
+		});
+	}
+
+	std::unique_ptr<FrameSource> Still::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		if(type == StreamType::Audio) {
+			return Blank(m_duration).get_frames(ctx, type, span);
+		}
+
+		// The image is a single frame, so there is no framerate to convert
+		FilterContext image_ctx(VideoParameters(ctx.vparams), AudioParameters(ctx.aparams));
+		image_ctx.vparams.fixed_fps = false;
+
+		AVFrame *frame = pool::alloc_frame();
+		error::handle_ffmpeg_error(span, frame ? 0 : AVERROR(ENOMEM));
+
+		if(!m_image->get_frames(image_ctx, type, m_image.span)->next_frame(&frame)) {
+			pool::free_frame(&frame);
+			throw error::empty_image(m_image.span);
+		}
+
+		return std::make_unique<StillFrameSource>(span, frame, ctx.vparams, m_duration);
+	}
+
+	int64_t gop_length(const VideoParameters& params) {
+		const long frames = std::max(1L, std::lround(params.fps * constants::ENCODER_GOP_SECONDS));
+
+		return util::FrameRateGrid(params.fps).pts(frames);
+	}
+
+	std::unique_ptr<PacketSource> repeat_gop(FilterContext& ctx, Span span, int64_t duration, const std::function<std::unique_ptr<PacketSource>(int64_t)>& encode_part) {
+		const int64_t unit = gop_length(ctx.vparams);
+
+		if(duration <= unit) {
+			return encode_part(duration);
+		}
+
+		const int64_t reps = duration / unit;
+		const int64_t rest = duration - reps * unit;
+
+		std::vector<std::unique_ptr<PacketSource>> parts;
+		parts.push_back(std::make_unique<RepeatPktSource>(span, encode_part(unit), static_cast<size_t>(reps)));
+
+		if(rest > 0) {
+			parts.push_back(encode_part(rest));
+		}
+
+		if(parts.size() == 1) {
+			return std::move(parts[0]);
+		}
+
+		return std::make_unique<ConcatPktSource>(span, std::move(parts), StreamType::Video);
+	}
+
+	StillFrameSource::StillFrameSource(Span span, const FilterContext& ctx, StreamType type, int64_t duration)
+		: m_span(span)
+		, m_type(type)
+		, m_frame(pool::alloc_frame())
+		, m_duration(duration)
+		, m_num_samples(0)
+		, m_idx(0)
+	{
+		error::handle_ffmpeg_error(m_span, m_frame ? 0 : AVERROR(ENOMEM));
+
+		if(type == StreamType::Video) {
+			m_frame_duration = av_inv_q(av_d2q(ctx.vparams.fps, std::numeric_limits<int>::max()));
+
+			m_frame->format              = constants::PIXEL_FORMAT;
+			m_frame->width               = ctx.vparams.width;
+			m_frame->height              = ctx.vparams.height;
+			m_frame->sample_aspect_ratio = constants::SAMPLE_ASPECT_RATIO;
+			m_frame->colorspace          = constants::COLOR_SPACE;
+			m_frame->color_range         = constants::COLOR_RANGE;
+			m_frame->color_primaries     = constants::COLOR_PRIMARIES;
+			m_frame->color_trc           = constants::COLOR_TRANSFER_FUNCTION;
+
+			error::handle_ffmpeg_error(m_span,
+				pool::get_buffer(m_frame)
+			);
+
+			ptrdiff_t linesize[4];
+			std::copy_n(m_frame->linesize, 4, linesize);
+
+			error::handle_ffmpeg_error(m_span,
+				av_image_fill_black(m_frame->data, linesize, constants::PIXEL_FORMAT, constants::COLOR_RANGE, m_frame->width, m_frame->height)
+			);
+		} else {
+			const AVSampleFormat sample_fmt = util::SampleFormat_get_AVSampleFormat(ctx.aparams.sample_format);
+
+			m_frame_duration = AVRational {static_cast<int>(constants::SAMPLES_PER_FRAME), ctx.aparams.sample_rate};
+			m_num_samples    = av_rescale_q(duration, constants::TIMEBASE, AVRational {1, ctx.aparams.sample_rate});
+
+			m_frame->format      = sample_fmt;
+			m_frame->sample_rate = ctx.aparams.sample_rate;
+			m_frame->nb_samples  = constants::SAMPLES_PER_FRAME;
+
+			error::handle_ffmpeg_error(m_span,
+				av_channel_layout_from_mask(&m_frame->ch_layout, ctx.aparams.channel_layout)
+			);
+
+			error::handle_ffmpeg_error(m_span,
+				pool::get_buffer(m_frame)
+			);
+
+			av_samples_set_silence(m_frame->extended_data, 0, m_frame->nb_samples, m_frame->ch_layout.nb_channels, sample_fmt);
+		}
+	}
+
+	StillFrameSource::StillFrameSource(Span span, AVFrame *frame, const VideoParameters& output, int64_t duration)
+		: m_span(span)
+		, m_type(StreamType::Video)
+		, m_frame(frame)
+		, m_frame_duration(av_inv_q(av_d2q(output.fps, std::numeric_limits<int>::max())))
+		, m_duration(duration)
+		, m_num_samples(0)
+		, m_idx(0)
+	{}
+
+	bool StillFrameSource::next_frame(AVFrame **p_frame) {
+		const int64_t pts = av_rescale_q(m_idx, m_frame_duration, constants::TIMEBASE);
+		const int64_t samples_left = m_num_samples - m_idx * static_cast<int64_t>(constants::SAMPLES_PER_FRAME);
+
+		if(pts >= m_duration || (m_type == StreamType::Audio && samples_left <= 0)) {
+			return false;
+		}
+
+		AVFrame *frame = *p_frame;
+
+		av_frame_unref(frame);
+
+		error::handle_ffmpeg_error(m_span,
+			av_frame_ref(frame, m_frame)
+		);
+
+		// The last audio frame is shorter, but it can still use the same buffer
+		if(m_type == StreamType::Audio) {
+			frame->nb_samples = static_cast<int>(std::min(samples_left, static_cast<int64_t>(frame->nb_samples)));
+		}
+
+		m_idx++;
+
+		frame->pts      = pts;
+		frame->duration = std::min(av_rescale_q(m_idx, m_frame_duration, constants::TIMEBASE), m_duration) - pts;
+
+		return true;
+	}
+
+	bool StillFrameSource::seek(int64_t ts) {
+		m_idx = std::max(av_rescale_q_rnd(ts, constants::TIMEBASE, m_frame_duration, AV_ROUND_DOWN), static_cast<int64_t>(0));
+
+		return true;
+	}
+
+	StillFrameSource::~StillFrameSource() {
+		pool::free_frame(&m_frame);
+	}
+}
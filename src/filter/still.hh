@@ -0,0 +1,81 @@
+#pragma once
+
+#include "src/error.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/params.hh"
+#include "src/filter/video_file.hh"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+extern "C" {
+	#include <libavutil/frame.h>
+	#include <libavutil/rational.h>
+}
+
+namespace vcat::filter {
+	// Shows an image for `duration` (with silent audio).
+	//
+	// One GOP of it is encoded once (an IDR frame followed by P-frames that the encoder skips), and longer stills
+	// repeat its packets (see `repeat_gop`).
+	class Still : public VFilter {
+		public:
+			Still() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			// NOTE: `duration` must be positive
+			Still(Spanned<const VideoFile&> image, int64_t duration);
+
+		private:
+			Spanned<const VideoFile&> m_image;
+			int64_t                   m_duration;
+	};
+
+	static_assert(!std::is_abstract<Still>());
+
+	// Gets the length of one GOP of the encoder's output
+	int64_t gop_length(const VideoParameters& params);
+
+	// Makes the packets of a video that doesn't change out of one encoded GOP of it, which is repeated to fill
+	// `duration`. `encode_part` encodes the first part of the video with the given length (its output should be
+	// cached).
+	std::unique_ptr<PacketSource> repeat_gop(FilterContext& ctx, Span span, int64_t duration, const std::function<std::unique_ptr<PacketSource>(int64_t)>& encode_part);
+
+	// Repeats one frame for `duration`. Every frame is a reference to the same buffer.
+	class StillFrameSource : public FrameSource {
+		public:
+			StillFrameSource() = delete;
+			StillFrameSource(StillFrameSource&) = delete;
+
+			// Repeats a black frame (or silent audio frame) with the output parameters
+			StillFrameSource(Span span, const FilterContext& ctx, StreamType type, int64_t duration);
+
+			// Repeats a video frame at the output framerate
+			//
+			// NOTE: this takes ownership of `frame`
+			StillFrameSource(Span span, AVFrame *frame, const VideoParameters& output, int64_t duration);
+
+			bool next_frame(AVFrame **frame);
+			bool seek(int64_t ts);
+
+			~StillFrameSource();
+
+		private:
+			Span       m_span;
+			StreamType m_type;
+			AVFrame   *m_frame;
+			AVRational m_frame_duration;
+			int64_t    m_duration;
+			int64_t    m_num_samples; //< The total number of samples (for audio)
+			int64_t    m_idx;         //< The index of the next frame
+	};
+
+	static_assert(!std::is_abstract<StillFrameSource>());
+}
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+#include "src/filter/trim.hh"
+#include "src/filter/concat.hh"
+#include "src/constants.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/video_file.hh"
+#include "src/util.hh"
+
+extern "C" {
+	#include <libavutil/rational.h>
+}
+
+namespace vcat::filter {
+	Trim::Trim(Spanned<const VFilter&> video, TimeRange range) : m_video(video), m_range(range) {}
+
+	void Trim::hash(Hasher& hasher) const {
+		hasher.add("_trim_");
+		const size_t start = hasher.pos();
+
+		m_video->hash(hasher);
+
+		hasher.add(m_range.start);
+		hasher.add(m_range.end.has_value());
+		hasher.add(m_range.end.value_or(0));
+
+		hasher.add((uint64_t) (hasher.pos() - start));
+	}
+
+	std::string Trim::to_string() const {
+		std::stringstream s;
+
+		s << "Trim(\n"
+			<< indent(m_video->to_string()) << ",\n"
+			<< indent(std::format("{}", av_q2d(constants::TIMEBASE) * m_range.start));
+
+		if(m_range.end) {
+			s << ",\n" << indent(std::format("{}", av_q2d(constants::TIMEBASE) * *m_range.end));
+		}
+
+		s << "\n)";
+
+		return s.str();
+	}
+
+	std::string Trim::type_name() const {
+		return "Trim";
+	}
+
+	void Trim::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		m_video->count_codecs(counts);
+	}
+
+	std::optional<int64_t> Trim::duration(FilterContext& ctx, Span) const {
+		const std::optional<int64_t> video_duration = m_video->duration(ctx, m_video.span);
+
+		if(!video_duration) {
+			return std::nullopt;
+		}
+
+		const int64_t end = std::min(m_range.end.value_or(*video_duration), *video_duration);
+
+		return std::max(end - m_range.start, static_cast<int64_t>(0));
+	}
+
+	std::optional<Trim::ConcatSlice> Trim::slice_concat(FilterContext& ctx, const Concat& concat) const {
+		ConcatSlice slice;
+		int64_t offset = 0;
+
+		for(const auto& video : concat.videos()) {
+			if(m_range.end && offset >= *m_range.end) {
+				break;
+			}
+
+			const std::optional<int64_t> duration = video->duration(ctx, video.span);
+
+			if(!duration) {
+				return std::nullopt;
+			}
+
+			const int64_t end = offset + *duration;
+
+			if(end > m_range.start) {
+				const TimeRange range {
+					.start = std::max(m_range.start - offset, static_cast<int64_t>(0)),
+					.end   = m_range.end && *m_range.end < end ? std::optional(*m_range.end - offset) : std::nullopt,
+				};
+
+				// Whole videos are used as-is so that they are copied (or fetched from the cache) exactly like in a
+				// full render
+				if(range.start == 0 && !range.end) {
+					slice.videos.push_back(video);
+				} else if(const Repeat *repeat = dynamic_cast<const Repeat *>(&video.val)) {
+					slice_repeat(*repeat, *duration / static_cast<int64_t>(repeat->count()), range, video.span, slice);
+				} else {
+					slice.parts.push_back(std::make_unique<Trim>(video, range));
+					slice.videos.emplace_back(*slice.parts.back(), video.span);
+				}
+			}
+
+			offset = end;
+		}
+
+		if(slice.videos.empty()) {
+			return std::nullopt;
+		}
+
+		return slice;
+	}
+
+	std::optional<Trim::ConcatSlice> Trim::slice_repeat(FilterContext& ctx, const Repeat& repeat) const {
+		const std::optional<int64_t> duration = repeat.duration(ctx, m_video.span);
+
+		if(!duration || m_range.start >= *duration) {
+			return std::nullopt;
+		}
+
+		const TimeRange range {
+			.start = m_range.start,
+			.end   = m_range.end && *m_range.end < *duration ? m_range.end : std::nullopt,
+		};
+
+		ConcatSlice slice;
+		slice_repeat(repeat, *duration / static_cast<int64_t>(repeat.count()), range, m_video.span, slice);
+
+		return slice;
+	}
+
+	void Trim::slice_repeat(const Repeat& repeat, int64_t length, const TimeRange& range, Span span, ConcatSlice& slice) {
+		const Spanned<const VFilter&> video = repeat.video();
+
+		if(length <= 0) {
+			slice.parts.push_back(std::make_unique<Trim>(Spanned<const VFilter&>(repeat, span), range));
+			slice.videos.emplace_back(*slice.parts.back(), span);
+			return;
+		}
+
+		const int64_t end   = range.end.value_or(length * static_cast<int64_t>(repeat.count()));
+		const int64_t first = range.start / length;
+		const int64_t last  = (end - 1) / length;
+
+		const int64_t start_in_first = range.start - first * length;
+		const int64_t end_in_last    = end - last * length;
+
+		const std::optional<int64_t> last_end = end_in_last < length ? std::optional(end_in_last) : std::nullopt;
+
+		const auto add_part = [&](TimeRange part) {
+			if(part.start == 0 && !part.end) {
+				slice.videos.push_back(video);
+				return;
+			}
+
+			slice.parts.push_back(std::make_unique<Trim>(video, part));
+			slice.videos.emplace_back(*slice.parts.back(), video.span);
+		};
+
+		if(first == last) {
+			add_part(TimeRange {.start = start_in_first, .end = last_end});
+			return;
+		}
+
+		add_part(TimeRange {.start = start_in_first, .end = std::nullopt});
+
+		// The whole repetitions in between are still repeated
+		const int64_t whole = last - first - 1;
+
+		if(whole == 1) {
+			slice.videos.push_back(video);
+		} else if(whole > 1) {
+			slice.parts.push_back(std::make_unique<Repeat>(video, static_cast<size_t>(whole)));
+			slice.videos.emplace_back(*slice.parts.back(), span);
+		}
+
+		add_part(TimeRange {.start = 0, .end = last_end});
+	}
+
+	std::unique_ptr<PacketSource> Trim::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(const Concat *concat = dynamic_cast<const Concat *>(&m_video.val)) {
+			if(auto slice = slice_concat(ctx, *concat)) {
+				return Concat(std::move(slice->videos), m_video.span).get_pkts(ctx, type, span);
+			}
+		}
+
+		if(const Repeat *repeat = dynamic_cast<const Repeat *>(&m_video.val)) {
+			if(auto slice = slice_repeat(ctx, *repeat)) {
+				return Concat(std::move(slice->videos), m_video.span).get_pkts(ctx, type, span);
+			}
+		}
+
+		if(const Speed *speed = dynamic_cast<const Speed *>(&m_video.val)) {
+			if(auto pkts = map_speed(ctx, *speed, type, span)) {
+				return pkts;
+			}
+		}
+
+		if(const Crossfade *crossfade = dynamic_cast<const Crossfade *>(&m_video.val)) {
+			if(auto pkts = map_crossfade(ctx, *crossfade, type, span)) {
+				return pkts;
+			}
+		}
+
+		if(const VideoFile *file = dynamic_cast<const VideoFile *>(&m_video.val)) {
+			const TimeRange range = file->snap_range(ctx, m_video.span, m_range);
+
+			if(auto pkts = file->get_pkts(ctx, type, m_video.span, range)) {
+				return pkts;
+			}
+
+			if(type == StreamType::Video) {
+				if(auto pkts = smart_render(ctx, *file, range, span)) {
+					return pkts;
+				}
+			}
+		}
+
+		return encode(ctx, span, *this, type);
+	}
+
+	std::unique_ptr<PacketSource> Trim::map_speed(FilterContext& ctx, const Speed& speed, StreamType type, Span span) const {
+		const Spanned<const VFilter&> video = speed.video();
+
+		// Speed changes are exact on packets, so `Speed(Trim(video, range * factor))` shows the same frames
+		const Trim trimmed(video, speed.source_range(m_range));
+
+		return Speed(Spanned<const VFilter&>(trimmed, video.span), speed.factor()).get_pkts(ctx, type, span);
+	}
+
+	std::unique_ptr<PacketSource> Trim::map_crossfade(FilterContext& ctx, const Crossfade& crossfade, StreamType type, Span span) const {
+		const Spanned<const VFilter&> first  = crossfade.first();
+		const Spanned<const VFilter&> second = crossfade.second();
+
+		const std::optional<int64_t> first_length = first->duration(ctx, first.span);
+
+		if(!first_length) {
+			return nullptr;
+		}
+
+		// Where the fade starts and ends in the output (the second video starts at `fade_start`)
+		const int64_t fade_start = *first_length - crossfade.fade_duration();
+		const int64_t fade_end   = *first_length;
+
+		const auto shift = [fade_start](std::optional<int64_t> ts) {
+			return ts ? std::optional(*ts - fade_start) : std::nullopt;
+		};
+
+		if(m_range.end && *m_range.end <= fade_start) {
+			return Trim(first, m_range).get_pkts(ctx, type, span);
+		}
+
+		if(m_range.start >= fade_end) {
+			return Trim(second, TimeRange {.start = m_range.start - fade_start, .end = shift(m_range.end)}).get_pkts(ctx, type, span);
+		}
+
+		// A range that only has part of the fade would need a different fade
+		if(m_range.start > fade_start || (m_range.end && *m_range.end < fade_end)) {
+			return nullptr;
+		}
+
+		const Trim first_part(first, TimeRange {.start = m_range.start, .end = std::nullopt});
+		const Trim second_part(second, TimeRange {.start = 0, .end = shift(m_range.end)});
+
+		return Crossfade(
+			m_range.start > 0 ? Spanned<const VFilter&>(first_part, first.span)   : first,
+			m_range.end       ? Spanned<const VFilter&>(second_part, second.span) : second,
+			crossfade.fade_duration()
+		).get_pkts(ctx, type, span);
+	}
+
+	std::unique_ptr<PacketSource> Trim::smart_render(FilterContext& ctx, const VideoFile& file, const TimeRange& range, Span span) const {
+		const std::optional<TimeRange> copied = file.copyable_range(ctx, m_video.span, range);
+		if(!copied) {
+			return nullptr;
+		}
+
+		TimeRange middle_range = *copied;
+		std::unique_ptr<PacketSource> middle;
+
+		// At the start of the output, the head can be pre-rolled from its keyframe instead of being re-encoded
+		if(ctx.allow_preroll && range.start < copied->start) {
+			middle = file.get_pkts(ctx, StreamType::Video, m_video.span, TimeRange {.start = range.start, .end = copied->end});
+
+			if(middle) {
+				middle_range.start = range.start;
+			}
+		}
+
+		if(!middle) {
+			middle = file.get_pkts(ctx, StreamType::Video, m_video.span, *copied);
+		}
+
+		if(!middle) {
+			return nullptr;
+		}
+
+		std::vector<std::unique_ptr<PacketSource>> parts;
+
+		// The ends are trims themselves, so they are cached like any other encode
+		if(range.start < middle_range.start) {
+			parts.push_back(encode(ctx, span, Trim(m_video, TimeRange {.start = range.start, .end = copied->start}), StreamType::Video));
+		}
+
+		parts.push_back(std::move(middle));
+
+		if(copied->end && range.end && *copied->end < *range.end) {
+			parts.push_back(encode(ctx, span, Trim(m_video, TimeRange {.start = *copied->end, .end = range.end}), StreamType::Video));
+		}
+
+		const AVCodecParameters *first_codec = parts[0]->video_codec();
+
+		for(const auto& part : parts) {
+			if(!ConcatPktSource::spliceable(part->video_codec(), first_codec)) {
+				return nullptr;
+			}
+		}
+
+		if(parts.size() == 1) {
+			return std::move(parts[0]);
+		}
+
+		return std::make_unique<ConcatPktSource>(span, std::move(parts), StreamType::Video);
+	}
+
+	std::unique_ptr<FrameSource> Trim::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		if(const Concat *concat = dynamic_cast<const Concat *>(&m_video.val)) {
+			if(auto slice = slice_concat(ctx, *concat)) {
+				return Concat(std::move(slice->videos), m_video.span).get_frames(ctx, type, span);
+			}
+		}
+
+		TimeRange range = m_range;
+
+		std::vector<std::unique_ptr<FrameSource>> sources;
+
+		// Video files can skip straight to the keyframe before the range. The cuts are snapped to the same frames
+		// as in `get_pkts` so that both paths give the same result.
+		if(const VideoFile *file = dynamic_cast<const VideoFile *>(&m_video.val)) {
+			range = file->snap_range(ctx, m_video.span, m_range);
+			sources.push_back(file->get_frames(ctx, type, m_video.span, range));
+		} else {
+			sources.push_back(m_video->get_frames(ctx, type, m_video.span));
+		}
+
+		const std::string_view prefix = type == StreamType::Audio ? "a" : "";
+
+		std::string filter = std::format("{}trim=start_pts={}", prefix, range.start);
+
+		if(range.end) {
+			filter += std::format(":end_pts={}", *range.end);
+		}
+
+		filter += std::format(",{}setpts=PTS-{}", prefix, range.start);
+
+		const StreamType input_types[] = {type};
+
+		return std::make_unique<FFMpegFilter>(span, std::move(sources), filter.c_str(), ctx, input_types, type);
+	}
+}
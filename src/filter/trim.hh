@@ -0,0 +1,69 @@
+#pragma once
+
+#include "src/filter/concat.hh"
+#include "src/filter/crossfade.hh"
+#include "src/filter/filter.hh"
+#include "src/filter/repeat.hh"
+#include "src/filter/speed.hh"
+#include "src/filter/video_file.hh"
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace vcat::filter {
+	// Cuts a video down to part of its timeline.
+	//
+	// When the source is a video file and the cuts land on clean keyframes, the packets are copied as-is.
+	// Otherwise, only the partial GOPs before the first and after the last clean keyframe are re-encoded
+	// ("smart rendering").
+	//
+	// When the source is a concatenation, only the videos that overlap the range are read (and trimmed). Likewise, trims
+	// of repetitions, speed changes, and crossfades are moved onto the videos that they are made of.
+	class Trim : public VFilter {
+		public:
+			Trim() = delete;
+			void hash(vcat::Hasher& hasher) const;
+			std::string to_string() const;
+			std::string type_name() const;
+
+			std::unique_ptr<PacketSource> get_pkts(FilterContext& ctx, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext& ctx, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+			std::optional<int64_t> duration(FilterContext& ctx, Span) const;
+
+			Trim(Spanned<const VFilter&> video, TimeRange range);
+
+		private:
+			// The videos of a concatenation that overlap the range
+			struct ConcatSlice {
+				std::vector<std::unique_ptr<VFilter>> parts; //< The filters for the videos that are only partly in the range
+				std::vector<Spanned<const VFilter&>>  videos;
+			};
+
+			// Maps the range onto the videos of a concatenation. Returns nothing if the length of one of them isn't
+			// known or if no video overlaps the range.
+			std::optional<ConcatSlice> slice_concat(FilterContext& ctx, const Concat& concat) const;
+
+			// Maps the range onto the repetitions of a video. Returns nothing if the length of the video isn't known or
+			// if the range is past its end.
+			std::optional<ConcatSlice> slice_repeat(FilterContext& ctx, const Repeat& repeat) const;
+
+			// Maps part of a repetition (with `length` being the length of one repetition) onto the repetitions that
+			// it overlaps. Only the ones at the ends are trimmed.
+			static void slice_repeat(const Repeat& repeat, int64_t length, const TimeRange& range, Span span, ConcatSlice& slice);
+
+			// Trims the source of a speed change or the videos of a crossfade instead of the output. Returns `nullptr`
+			// if the range can't be mapped onto them.
+			std::unique_ptr<PacketSource> map_speed(FilterContext& ctx, const Speed& speed, StreamType type, Span span) const;
+			std::unique_ptr<PacketSource> map_crossfade(FilterContext& ctx, const Crossfade& crossfade, StreamType type, Span span) const;
+
+			// Re-encodes the ends of the range and copies the middle. Returns `nullptr` if the video can't be
+			// copied or the encoded parts can't be spliced with it.
+			std::unique_ptr<PacketSource> smart_render(FilterContext& ctx, const VideoFile& file, const TimeRange& range, Span span) const;
+
+			Spanned<const VFilter&> m_video;
+			TimeRange               m_range;
+	};
+
+	static_assert(!std::is_abstract<Trim>());
+}
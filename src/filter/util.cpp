@@ -2,9 +2,13 @@
 #include "src/constants.hh"
 #include "src/error.hh"
 #include "src/filter/error.hh"
+#include "src/filter/h264.hh"
 #include "src/filter/params.hh"
+#include "src/filter/pool.hh"
 #include "src/filter/util.hh"
+#include <algorithm>
 #include <cerrno>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -12,6 +16,8 @@
 #include <endian.h>
 #include <format>
 #include <iostream>
+#include <limits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -31,10 +37,37 @@ extern "C" {
 	#include <libavutil/display.h>
 	#include <libavutil/error.h>
 	#include <libavutil/frame.h>
+	#include <libavutil/mathematics.h>
+	#include <libavutil/opt.h>
 	#include <libavutil/rational.h>
 }
 
 namespace vcat::filter::util {
+	bool display_matrices_equal(const AVPacketSideData *matrix1, const AVPacketSideData *matrix2) {
+		typedef int32_t DisplayMatrix[9];
+
+		static constexpr DisplayMatrix IDENTITY = {
+			1 << 16, 0,       0,
+			0,       1 << 16, 0,
+			0,       0,       1 << 30,
+		};
+
+		const int32_t *m1 = matrix1 ? (const int32_t *) matrix1->data : &IDENTITY[0];
+		const int32_t *m2 = matrix2 ? (const int32_t *) matrix2->data : &IDENTITY[0];
+
+		return memcmp(m1, m2, sizeof(DisplayMatrix)) == 0;
+	}
+
+	const AVPacketSideData *display_matrix(const AVCodecParameters *params) {
+		const AVPacketSideData *side_data = av_packet_side_data_get(params->coded_side_data, params->nb_coded_side_data, AV_PKT_DATA_DISPLAYMATRIX);
+
+		if(side_data && side_data->size < sizeof(int32_t) * 9) {
+			return nullptr;
+		}
+
+		return side_data;
+	}
+
 	bool codecs_are_compatible(const AVCodecParameters *params1, const AVCodecParameters *params2) {
 		if(
 			params1->codec_type     != params2->codec_type     ||
@@ -55,6 +88,11 @@ namespace vcat::filter::util {
 		}
 
 		if(params1->codec_type == AVMEDIA_TYPE_VIDEO) {
+			// Rotation is passed through as metadata on the lossless path, so the clips must agree on it
+			if(!display_matrices_equal(display_matrix(params1), display_matrix(params2))) {
+				return false;
+			}
+
 			return
 				params1->width           == params2->width           &&
 				params1->height          == params2->height          &&
@@ -93,6 +131,112 @@ namespace vcat::filter::util {
 		return true;
 	}
 
+	// Checks if a stream uses a profile that players of our output can be expected to decode (for H.264, anything up
+	// to the High profile that our encoder uses) and has the configuration record that MP4 requires (`avcC`, `hvcC`,
+	// or `av1C`)
+	static bool has_output_profile(const AVCodecParameters *params) {
+		switch(params->codec_id) {
+			case AV_CODEC_ID_H264:
+				if(
+					params->profile != AV_PROFILE_H264_BASELINE             &&
+					params->profile != AV_PROFILE_H264_CONSTRAINED_BASELINE &&
+					params->profile != AV_PROFILE_H264_MAIN                 &&
+					params->profile != AV_PROFILE_H264_HIGH
+				) {
+					return false;
+				}
+
+				return params->extradata_size > 0 && params->extradata[0] == 1;
+			case AV_CODEC_ID_HEVC:
+				return params->profile == AV_PROFILE_HEVC_MAIN && params->extradata_size > 0 && params->extradata[0] == 1;
+			case AV_CODEC_ID_AV1:
+				return params->profile == AV_PROFILE_AV1_MAIN && params->extradata_size >= 4 && params->extradata[0] == 0x81;
+			default:
+				return false;
+		}
+	}
+
+	bool codec_matches_output(const AVCodecParameters *params, const VideoParameters& output) {
+		if(params->codec_type != AVMEDIA_TYPE_VIDEO || params->codec_id != VideoCodec_get_AVCodecID(output.codec)) {
+			return false;
+		}
+
+		if(!has_output_profile(params)) {
+			return false;
+		}
+
+		if(params->field_order != AV_FIELD_UNKNOWN && params->field_order != AV_FIELD_PROGRESSIVE) {
+			return false;
+		}
+
+		const VFrameInfo info(params);
+
+		// The display matrix is passed through, so a rotated video must match the output once it is rotated
+		int display_width  = info.width;
+		int display_height = info.height;
+
+		if(info.rotation_degrees == 90.0 || info.rotation_degrees == -90.0) {
+			std::swap(display_width, display_height);
+		} else if(info.rotation_degrees != 0.0 && info.rotation_degrees != 180.0 && info.rotation_degrees != -180.0) {
+			return false;
+		}
+
+		const bool unknown_sar = info.sar.num == 0;
+
+		return
+			display_width        == output.width                       &&
+			display_height       == output.height                      &&
+			info.pix_fmt         == constants::PIXEL_FORMAT            &&
+			info.color_space     == constants::COLOR_SPACE             &&
+			info.color_range     == constants::COLOR_RANGE             &&
+			info.color_primaries == constants::COLOR_PRIMARIES         &&
+			info.color_trc       == constants::COLOR_TRANSFER_FUNCTION &&
+			(unknown_sar || av_cmp_q(info.sar, constants::SAMPLE_ASPECT_RATIO) == 0);
+	}
+
+	// Checks if a stream is AAC-LC with a 1024-sample frame length and an `AudioSpecificConfig`
+	static bool is_aac_lc(const AVCodecParameters *params) {
+		return
+			params->codec_type     == AVMEDIA_TYPE_AUDIO &&
+			params->codec_id       == AV_CODEC_ID_AAC    &&
+			params->profile        == AV_PROFILE_AAC_LOW &&
+			params->extradata_size >= 2                  &&
+			(params->frame_size == 0 || params->frame_size == static_cast<int>(constants::SAMPLES_PER_FRAME));
+	}
+
+	bool codec_matches_output(const AVCodecParameters *params, const AudioParameters& output) {
+		if(!is_aac_lc(params) || params->sample_rate != output.sample_rate) {
+			return false;
+		}
+
+		AVChannelLayout layout;
+		if(av_channel_layout_from_mask(&layout, output.channel_layout) < 0) {
+			return false;
+		}
+
+		const bool same_layout = av_channel_layout_compare(&params->ch_layout, &layout) == 0;
+		av_channel_layout_uninit(&layout);
+
+		return same_layout;
+	}
+
+	bool aac_configs_compatible(const AVCodecParameters *params1, const AVCodecParameters *params2) {
+		if(!is_aac_lc(params1) || !is_aac_lc(params2)) {
+			return false;
+		}
+
+		if(
+			params1->sample_rate != params2->sample_rate ||
+			av_channel_layout_compare(&params1->ch_layout, &params2->ch_layout) != 0
+		) {
+			return false;
+		}
+
+		// The first 16 bits hold the object type, sampling frequency index, channel configuration, and the
+		// `GASpecificConfig` flags. Everything after that is an extension.
+		return params1->extradata[0] == params2->extradata[0] && params1->extradata[1] == params2->extradata[1];
+	}
+
 	void hash_avcodec_params(Hasher& hasher, const AVCodecParameters& p, Span s) {
 		hasher.add("_avcodec-params_");
 		const size_t start = hasher.pos();
@@ -127,6 +271,10 @@ namespace vcat::filter::util {
 			hasher.add(p.color_trc);
 			hasher.add(p.color_space);
 			hasher.add(p.chroma_location);
+
+			if(const AVPacketSideData *matrix = display_matrix(&p)) {
+				hasher.add(matrix->data, sizeof(int32_t) * 9);
+			}
 		} else {
 			hasher.add(p.sample_rate);
 			hasher.add(p.block_align);
@@ -148,7 +296,7 @@ namespace vcat::filter::util {
 		hasher.add((uint64_t) (hasher.pos() - start));
 	}
 
-	AVCodecContext *create_decoder(Span span, const AVCodecParameters *params) {
+	AVCodecContext *create_decoder(Span span, const AVCodecParameters *params, const VideoParameters *pooled_output) {
 		const AVCodec *av_decoder = avcodec_find_decoder(params->codec_id);
 		if(!av_decoder) {
 			throw error::ffmpeg_no_codec(span, params->codec_id);
@@ -161,15 +309,85 @@ namespace vcat::filter::util {
 			avcodec_parameters_to_context(decode_ctx, params)
 		);
 
+		if(pooled_output) {
+			pool::use_for_decoder(decode_ctx, *pooled_output);
+		}
+
 		avcodec_open2(decode_ctx, av_decoder, nullptr);
 
 		return decode_ctx;
 	}
 
-	AVCodecContext *create_video_encoder(Span span, const VideoParameters& params) {
-		const AVCodec *av_encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+	struct H264Level {
+		int level_idc;
+		int64_t max_mbps;    //< Max macroblocks per second
+		int64_t max_fs;      //< Max macroblocks per frame
+		int64_t max_dpb_mbs; //< Max macroblocks in the decoded picture buffer
+	};
+
+	// From Table A-1 of the H.264 specification
+	static constexpr H264Level H264_LEVELS[] = {
+		{30,    40'500,   1'620,   8'100},
+		{31,   108'000,   3'600,  18'000},
+		{32,   216'000,   5'120,  20'480},
+		{40,   245'760,   8'192,  32'768},
+		{41,   245'760,   8'192,  32'768},
+		{42,   522'240,   8'704,  34'816},
+		{50,   589'824,  22'080, 110'400},
+		{51,   983'040,  36'864, 184'320},
+		{52, 2'073'600,  36'864, 184'320},
+		{60, 4'177'920, 139'264, 696'320},
+		{61, 8'355'840, 139'264, 696'320},
+		{62,16'711'680, 139'264, 696'320},
+	};
+
+	int h264_level(const VideoParameters& params) {
+		const int64_t width_mbs  = (params.width  + 15) / 16;
+		const int64_t height_mbs = (params.height + 15) / 16;
+		const int64_t frame_mbs  = width_mbs * height_mbs;
+
+		for(const H264Level& level : H264_LEVELS) {
+			if(
+				frame_mbs                           <= level.max_fs      &&
+				frame_mbs * params.fps              <= level.max_mbps    &&
+				frame_mbs * constants::ENCODER_REFS <= level.max_dpb_mbs &&
+				width_mbs  * width_mbs              <= level.max_fs * 8  &&
+				height_mbs * height_mbs             <= level.max_fs * 8
+			) {
+				return level.level_idc;
+			}
+		}
+
+		return H264_LEVELS[std::size(H264_LEVELS) - 1].level_idc;
+	}
+
+	bool encoder_can_match(const AVCodecParameters *reference, const VideoParameters& params) {
+		// Only H.264 has a way of switching parameter sets mid-stream, and the encoder's output is neither rotated nor
+		// stored with anything other than 4-byte NAL unit lengths
+		if(
+			reference->codec_type != AVMEDIA_TYPE_VIDEO                    ||
+			reference->codec_id   != AV_CODEC_ID_H264                      ||
+			VideoCodec_get_AVCodecID(params.codec) != AV_CODEC_ID_H264     ||
+			h264::nal_length_size(reference) != 4                          ||
+			!h264::parameter_sets(reference)                               ||
+			display_matrix(reference) != nullptr
+		) {
+			return false;
+		}
+
+		return
+			reference->format == AV_PIX_FMT_YUV420P &&
+			reference->width  == params.width       &&
+			reference->height == params.height      &&
+			(reference->field_order == AV_FIELD_UNKNOWN || reference->field_order == AV_FIELD_PROGRESSIVE);
+	}
+
+	AVCodecContext *create_video_encoder(Span span, const VideoParameters& params, const AVCodecParameters *reference) {
+		const AVCodecID codec_id = VideoCodec_get_AVCodecID(params.codec);
+
+		const AVCodec *av_encoder = avcodec_find_encoder(codec_id);
 		if(!av_encoder) {
-			throw error::ffmpeg_no_codec(span, AV_CODEC_ID_H264);
+			throw error::ffmpeg_no_codec(span, codec_id);
 		}
 
 		AVCodecContext *encode_ctx = avcodec_alloc_context3(av_encoder);
@@ -182,6 +400,57 @@ namespace vcat::filter::util {
 
 		encode_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER | AV_CODEC_FLAG_COPY_OPAQUE;
 
+		// Everything that ends up in the stream headers is pinned so that any two streams encoded with the same
+		// `VideoParameters` have identical extradata (and can therefore be concatenated without re-encoding)
+		encode_ctx->gop_size = std::max(1, static_cast<int>(std::lround(params.fps * constants::ENCODER_GOP_SECONDS)));
+		encode_ctx->flags   |= AV_CODEC_FLAG_CLOSED_GOP;
+
+		switch(codec_id) {
+			case AV_CODEC_ID_H264:
+				encode_ctx->profile      = AV_PROFILE_H264_HIGH;
+				encode_ctx->level        = h264_level(params);
+				encode_ctx->refs         = constants::ENCODER_REFS;
+				encode_ctx->max_b_frames = 3;
+				break;
+			case AV_CODEC_ID_HEVC:
+				encode_ctx->profile = AV_PROFILE_HEVC_MAIN;
+				break;
+			case AV_CODEC_ID_AV1:
+				encode_ctx->profile = AV_PROFILE_AV1_MAIN;
+				break;
+			default:
+				break;
+		}
+
+		encode_ctx->framerate           = av_d2q(params.fps, std::numeric_limits<int>::max());
+		encode_ctx->sample_aspect_ratio = constants::SAMPLE_ASPECT_RATIO;
+		encode_ctx->colorspace          = constants::COLOR_SPACE;
+		encode_ctx->color_range         = constants::COLOR_RANGE;
+		encode_ctx->color_primaries     = constants::COLOR_PRIMARIES;
+		encode_ctx->color_trc           = constants::COLOR_TRANSFER_FUNCTION;
+
+		// `codec_matches_output` only accepts streams whose colors are the output ones (or unspecified), so the
+		// frames don't change; only the way that they are tagged does
+		if(reference) {
+			encode_ctx->colorspace             = reference->color_space;
+			encode_ctx->color_range            = reference->color_range;
+			encode_ctx->color_primaries        = reference->color_primaries;
+			encode_ctx->color_trc              = reference->color_trc;
+			encode_ctx->chroma_sample_location = reference->chroma_location;
+			encode_ctx->field_order            = reference->field_order;
+		}
+
+		if(strcmp(av_encoder->name, "libx264") == 0) {
+			error::handle_ffmpeg_error(span,
+				av_opt_set(encode_ctx->priv_data, "profile", "high", 0)
+			);
+
+			// `stitchable` stops x264 from optimizing the headers based on the content of the video
+			error::handle_ffmpeg_error(span,
+				av_opt_set(encode_ctx->priv_data, "x264-params", "stitchable=1:b-pyramid=normal", 0)
+			);
+		}
+
 		avcodec_open2(encode_ctx, av_encoder, nullptr);
 
 		return encode_ctx;
@@ -454,16 +723,8 @@ namespace vcat::filter::util {
 		}
 
 
-		for(int i = 0; i < params->nb_coded_side_data; i++) {
-			if(params->coded_side_data[i].type != AV_PKT_DATA_DISPLAYMATRIX) {
-				continue;
-			}
-
-			typedef int32_t DisplayMatrix[9];
-
-			const DisplayMatrix *display_matrix = (DisplayMatrix *) params->coded_side_data[i].data;
-			this->rotation_degrees = -av_display_rotation_get(*display_matrix);
-			break;
+		if(const AVPacketSideData *matrix = display_matrix(params)) {
+			this->rotation_degrees = -av_display_rotation_get((const int32_t *) matrix->data);
 		}
 	}
 
@@ -510,6 +771,18 @@ namespace vcat::filter::util {
 		, channel_layout(params.channel_layout)
 	{}
 
+	FrameRateGrid::FrameRateGrid(double fps)
+		: m_frame_duration(av_inv_q(av_d2q(fps, std::numeric_limits<int>::max())))
+	{}
+
+	int64_t FrameRateGrid::slot(int64_t ts) const {
+		return av_rescale_q_rnd(ts, constants::TIMEBASE, m_frame_duration, AV_ROUND_NEAR_INF);
+	}
+
+	int64_t FrameRateGrid::pts(int64_t slot) const {
+		return av_rescale_q_rnd(slot, m_frame_duration, constants::TIMEBASE, AV_ROUND_NEAR_INF);
+	}
+
 	const AVFilter *get_avfilter(const char *name, Span s) {
 		const AVFilter *filter = avfilter_get_by_name(name);
 
@@ -533,4 +806,20 @@ namespace vcat::filter::util {
 		std::cerr << "Internal error: invalid SampleFormat\n";
 		std::abort();
 	}
+
+	AVCodecID VideoCodec_get_AVCodecID(shared::VideoCodec codec) {
+		switch(codec) {
+			case shared::h264:
+				return AV_CODEC_ID_H264;
+			case shared::hevc:
+				return AV_CODEC_ID_HEVC;
+			case shared::av1:
+				return AV_CODEC_ID_AV1;
+			case shared::automatic:
+				break;
+		}
+
+		std::cerr << "Internal error: invalid VideoCodec\n";
+		std::abort();
+	}
 }
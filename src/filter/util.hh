@@ -17,9 +17,42 @@ extern "C" {
 
 namespace vcat::filter::util {
 	bool codecs_are_compatible(const AVCodecParameters *params1, const AVCodecParameters *params2);
-	AVCodecContext *create_decoder(Span span, const AVCodecParameters *params);
 
-	AVCodecContext *create_video_encoder(Span span, const VideoParameters& params);
+	// Checks if a video stream already has the output codec, format, and dimensions, meaning that it can be
+	// packet-copied into the output without being re-encoded.
+	//
+	// NOTE: this does not check the framerate (see `VideoFilePktSource::timestamps_on_grid`)
+	bool codec_matches_output(const AVCodecParameters *params, const VideoParameters& output);
+
+	// Checks if an audio stream is AAC-LC with the output sample rate and channel layout, meaning that it can be
+	// packet-copied into the output without being re-encoded.
+	bool codec_matches_output(const AVCodecParameters *params, const AudioParameters& output);
+
+	// Checks if two AAC-LC streams can be decoded with the same `AudioSpecificConfig`. Unlike
+	// `codecs_are_compatible`, this ignores trailing extensions that don't affect AAC-LC (eg FFMPEG's encoder
+	// always signals that there is no SBR).
+	bool aac_configs_compatible(const AVCodecParameters *params1, const AVCodecParameters *params2);
+
+	// Gets the display matrix (`AV_PKT_DATA_DISPLAYMATRIX`) of a stream or `nullptr` if it has none.
+	const AVPacketSideData *display_matrix(const AVCodecParameters *params);
+
+	// Checks if two display matrices are equal (a missing display matrix is the identity matrix)
+	bool display_matrices_equal(const AVPacketSideData *matrix1, const AVPacketSideData *matrix2);
+	// If `pooled_output` is specified, frames with the output dimensions are allocated from a buffer pool (see
+	// `pool::use_for_decoder`)
+	AVCodecContext *create_decoder(Span span, const AVCodecParameters *params, const VideoParameters *pooled_output = nullptr);
+
+	// Gets the lowest H.264 level (`level_idc`) that can hold video with the given parameters (this is the level
+	// used by the video encoder)
+	int h264_level(const VideoParameters& params);
+
+	// Checks if the video encoder can produce a stream that can be spliced with `reference` (a stream that
+	// `codec_matches_output` accepted) by matching the parts of its headers that the encoder doesn't pin
+	bool encoder_can_match(const AVCodecParameters *reference, const VideoParameters& params);
+
+	// If `reference` is specified (see `encoder_can_match`), its color tags and chroma location are used instead of
+	// the output ones
+	AVCodecContext *create_video_encoder(Span span, const VideoParameters& params, const AVCodecParameters *reference = nullptr);
 	AVCodecContext *create_audio_encoder(Span span, const AudioParameters& params);
 
 	struct VFrameInfo {
@@ -53,6 +86,21 @@ namespace vcat::filter::util {
 
 	using SFrameInfo = std::variant<VFrameInfo, AFrameInfo>;
 
+	// The frame timestamps of a fixed-framerate video (in `constants::TIMEBASE`)
+	class FrameRateGrid {
+		public:
+			FrameRateGrid(double fps);
+
+			// Gets the index of the frame slot nearest to `ts`
+			int64_t slot(int64_t ts) const;
+
+			// Gets the timestamp of a frame slot
+			int64_t pts(int64_t slot) const;
+
+		private:
+			AVRational m_frame_duration;
+	};
+
 	struct FilterGraphInfo {
 		AVFilterGraph *graph;
 		std::vector<AVFilterContext *> inputs;
@@ -99,4 +147,5 @@ namespace vcat::filter::util {
 	const AVFilter *get_avfilter(const char *name, Span);
 
 	AVSampleFormat SampleFormat_get_AVSampleFormat(shared::SampleFormat format);
+	AVCodecID VideoCodec_get_AVCodecID(shared::VideoCodec codec);
 }
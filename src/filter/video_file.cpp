@@ -1,15 +1,24 @@
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
 #include <format>
 #include <iomanip>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <optional>
+#include <ranges>
+#include <utility>
 
 #include "src/filter/video_file.hh"
+#include "src/filter/audio_fit.hh"
 #include "src/constants.hh"
 #include "src/filter/error.hh"
 #include "src/filter/filter.hh"
+#include "src/filter/h264.hh"
+#include "src/filter/pool.hh"
 #include "src/filter/util.hh"
 #include "src/util.hh"
 
@@ -21,6 +30,10 @@ extern "C" {
 }
 
 namespace vcat::filter {
+	static void calculate_packet_duration(FilterContext& ctx, std::span<vcat::filter::PacketTimestampInfo> ts_info);
+	static void calculate_packet_dts(std::span<vcat::filter::PacketTimestampInfo> ts_info, size_t& dts_shift);
+	static TsInfo pts_end_info(std::span<const PacketTimestampInfo> ts_info, int64_t end_padding);
+
 	void VideoFile::hash(Hasher& hasher) const {
 		hasher.add("_videofile_");
 		hasher.add(&m_file_hash, sizeof(m_file_hash));
@@ -28,7 +41,11 @@ namespace vcat::filter {
 	}
 
 	// NOTE: throws `std::string` upon IO failure
-	VideoFile::VideoFile(std::string&& path) : m_path(std::move(path)) {
+	VideoFile::VideoFile(std::string&& path)
+		: m_path(std::move(path))
+		, m_index()
+		, m_index_fps(0)
+	{
 		std::ifstream f;
 		f.open(m_path, std::ios_base::in | std::ios_base::binary);
 
@@ -65,28 +82,60 @@ namespace vcat::filter {
 	}
 
 	VideoFilePktSource::VideoFilePktSource(FilterContext& fctx, StreamType type, const std::string& path, Span span)
-		: m_ctx(avformat_alloc_context())
+		: VideoFilePktSource(type, path, index_file(fctx, path, span), span)
+	{}
+
+	VideoFilePktSource::VideoFilePktSource(StreamType type, const std::string& path, const FileIndex& index, Span span)
+		: m_ctx(nullptr)
 		, m_span(span)
 		, m_dts_shift(0)
+		, m_stream_idx(0)
 		, m_pkt_no(0)
+		, m_pts_shift(0)
+		, m_end_padding(0)
+		, m_seek_pts()
+		, m_type(type)
+		, m_path(path)
 		, m_file()
 	{
+		const std::optional<StreamIndex>& stream = type == StreamType::Video ? index.video : index.audio;
+
+		if(!stream) {
+			// TODO: allow for empty streams
+			// we will set a flag and fill in the current stream with an 'blank' version (to match the length
+			// of the other stream)
+			throw error::no_video(m_span, path);
+		}
+
+		m_stream_idx  = stream->stream_idx;
+		m_dts_shift   = stream->dts_shift;
+		m_pts_shift   = stream->pts_shift;
+		m_end_padding = stream->end_padding;
+		m_ts_info     = stream->ts_info;
+
+		index_keyframes();
+	}
+
+	void VideoFilePktSource::open() {
+		if(m_ctx != nullptr) {
+			return;
+		}
+
 		errno = 0;
-		FILE *fp = fopen(path.c_str(), "rb");  
+		FILE *fp = fopen(m_path.c_str(), "rb");
 
 		if(errno != 0) {
-			throw error::failed_file_open(m_span, path);
+			throw error::failed_file_open(m_span, m_path);
 		}
 
 		new(&m_file) util::VCatAVFile(fp);
 
-		calculate_info(fctx, type, path);
-
+		m_ctx = avformat_alloc_context();
 		m_ctx->flags |= AVFMT_FLAG_SORT_DTS | AVFMT_FLAG_GENPTS | AVFMT_AVOID_NEG_TS_MAKE_ZERO;
 		m_ctx->pb = m_file.get();
 
 		error::handle_ffmpeg_error(m_span,
-			avformat_open_input(&m_ctx, path.c_str(), NULL, NULL)
+			avformat_open_input(&m_ctx, m_path.c_str(), NULL, NULL)
 		);
 
 		error::handle_ffmpeg_error(m_span,
@@ -95,6 +144,22 @@ namespace vcat::filter {
 	}
 
 	bool VideoFilePktSource::next_pkt(AVPacket **p_packet) {
+		if(m_pkt_no >= m_ts_info.size()) {
+			return false;
+		}
+
+		open();
+
+		if(m_seek_pts) {
+			const AVStream *stream = m_ctx->streams[m_stream_idx];
+
+			error::handle_ffmpeg_error(m_span,
+				av_seek_frame(m_ctx, m_stream_idx, av_rescale_q(*m_seek_pts, constants::TIMEBASE, stream->time_base), AVSEEK_FLAG_BACKWARD)
+			);
+
+			m_seek_pts.reset();
+		}
+
 		start:
 		AVPacket *const packet = *p_packet;
 
@@ -114,11 +179,17 @@ namespace vcat::filter {
 		packet->stream_index = 0;
 
 		av_packet_rescale_ts(packet, old_timebase, constants::TIMEBASE);
+		packet->pts -= m_pts_shift;
 
 		const int64_t pts = packet->pts;
 		const auto bsr = binary_search_by(std::span(m_ts_info), [pts](const auto& inf){return inf.pts <=> pts;});
 
-		assert(bsr.first);
+		// After seeking, the demuxer may start a few packets early
+		if(!bsr.first || m_ts_info[bsr.second].decode_idx < m_pkt_no) {
+			av_packet_unref(packet);
+			goto start;
+		}
+
 		const PacketTimestampInfo pti = m_ts_info[bsr.second];
 
 		packet->dts = pti.dts;
@@ -126,15 +197,269 @@ namespace vcat::filter {
 
 		assert(packet->dts != AV_NOPTS_VALUE);
 
+		if(m_pkt_no == 0) {
+			forward_display_matrix(packet);
+		}
+
 		m_pkt_no += 1;
 		return true;
 	}
 
+	// Attaches the stream's rotation to a packet so that it survives packet-copying
+	void VideoFilePktSource::forward_display_matrix(AVPacket *packet) {
+		const AVPacketSideData *matrix = util::display_matrix(video_codec());
+
+		if(!matrix || av_packet_get_side_data(packet, AV_PKT_DATA_DISPLAYMATRIX, nullptr)) {
+			return;
+		}
+
+		uint8_t *data = av_packet_new_side_data(packet, AV_PKT_DATA_DISPLAYMATRIX, matrix->size);
+		error::handle_ffmpeg_error(m_span, data ? 0 : AVERROR(ENOMEM));
+
+		memcpy(data, matrix->data, matrix->size);
+	}
+
+	bool VideoFilePktSource::timestamps_on_grid(const util::FrameRateGrid& grid) const {
+		for(const PacketTimestampInfo& ts : m_ts_info) {
+			const int64_t slot = grid.slot(ts.pts);
+
+			// Allow for rounding errors from the container's timebase
+			if(std::abs(ts.pts - grid.pts(slot)) > 1) {
+				return false;
+			}
+
+			// Durations are the distance to the next frame, so this also rules out dropped/duplicated frames
+			if(grid.slot(ts.pts + ts.duration) != slot + 1) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	TimeRange VideoFilePktSource::snap(const TimeRange& range) const {
+		// The frames whose midpoints lie in the range are kept
+		const auto boundary = [this](int64_t ts) {
+			for(const PacketTimestampInfo& info : m_ts_info) {
+				if(info.pts + info.duration / 2 >= ts) {
+					return info.pts;
+				}
+			}
+
+			const PacketTimestampInfo& last = m_ts_info.back();
+			return last.pts + last.duration;
+		};
+
+		TimeRange snapped {.start = boundary(range.start), .end = std::nullopt};
+
+		if(range.end) {
+			snapped.end = boundary(*range.end);
+		}
+
+		return snapped;
+	}
+
+	std::pair<size_t, size_t> VideoFilePktSource::decode_range(const TimeRange& range, bool preroll) const {
+		size_t begin = m_ts_info.size();
+		size_t end = 0;
+
+		std::optional<int64_t> keyframe_pts;
+
+		// Audio packets are independent. Video decoding starts at the last keyframe before the range.
+		if(m_type == StreamType::Video) {
+			for(const PacketTimestampInfo& info : m_ts_info) {
+				if(info.keyframe && info.pts <= range.start && (!keyframe_pts || info.pts > *keyframe_pts)) {
+					keyframe_pts = info.pts;
+					begin = info.decode_idx;
+				}
+			}
+		}
+
+		for(const PacketTimestampInfo& info : m_ts_info) {
+			const bool before = m_type == StreamType::Video
+				? info.pts < range.start && info.pts != keyframe_pts
+				: info.pts + info.duration <= range.start;
+
+			if(before) {
+				continue;
+			}
+
+			if(range.end && info.pts >= *range.end) {
+				continue;
+			}
+
+			begin = std::min(begin, info.decode_idx);
+			end   = std::max(end, info.decode_idx + 1);
+		}
+
+		// AAC frames overlap, so the first one needs the one before it to be decoded correctly
+		if(m_type == StreamType::Audio && preroll && begin > 0 && begin < end) {
+			begin--;
+		}
+
+		return {begin, std::max(begin, end)};
+	}
+
+	void VideoFilePktSource::restrict_packets(size_t begin, size_t end) {
+		std::erase_if(m_ts_info, [begin, end](const PacketTimestampInfo& info) {
+			return info.decode_idx < begin || info.decode_idx >= end;
+		});
+
+		if(m_ts_info.empty()) {
+			throw error::empty_range(m_span);
+		}
+
+		if(begin > 0) {
+			const auto first = std::ranges::find(m_ts_info, begin, &PacketTimestampInfo::decode_idx);
+			m_seek_pts = first->pts + m_pts_shift;
+		}
+
+		for(PacketTimestampInfo& info : m_ts_info) {
+			info.decode_idx -= begin;
+		}
+
+		calculate_packet_dts(m_ts_info, m_dts_shift);
+		index_keyframes();
+	}
+
+	void VideoFilePktSource::index_keyframes() {
+		m_keyframes.clear();
+
+		for(size_t i = 0; i < m_ts_info.size(); i++) {
+			if(m_ts_info[i].keyframe) {
+				m_keyframes.push_back(i);
+			}
+		}
+	}
+
+	bool VideoFilePktSource::seek(int64_t ts) {
+		const auto keyframe = std::ranges::upper_bound(m_keyframes, ts, {}, [this](size_t idx) {
+			return m_ts_info[idx].pts;
+		});
+
+		// Before the first keyframe, everything is read from the start
+		const auto first = keyframe == m_keyframes.begin()
+			? std::ranges::find(m_ts_info, 0, &PacketTimestampInfo::decode_idx)
+			: m_ts_info.begin() + *(keyframe - 1);
+
+		if(first == m_ts_info.end()) {
+			return false;
+		}
+
+		m_pkt_no   = first->decode_idx;
+		m_seek_pts = first->pts + m_pts_shift;
+
+		return true;
+	}
+
+	void VideoFilePktSource::seek_range(const TimeRange& range) {
+		const auto [begin, end] = decode_range(range, true);
+
+		restrict_packets(begin, end);
+	}
+
+	bool VideoFilePktSource::trim(const TimeRange& range, bool preroll) {
+		const auto [begin, end] = decode_range(range, false);
+
+		if(m_type == StreamType::Video) {
+			int64_t first_pts = range.start;
+
+			if(preroll) {
+				const auto first = std::ranges::find(m_ts_info, begin, &PacketTimestampInfo::decode_idx);
+
+				if(first != m_ts_info.end()) {
+					first_pts = std::min(first_pts, first->pts);
+				}
+			}
+
+			// Every packet that is decoded must also be shown (or be part of the pre-roll)
+			for(const PacketTimestampInfo& info : m_ts_info) {
+				const bool decoded = info.decode_idx >= begin && info.decode_idx < end;
+				const bool shown   = info.pts >= first_pts && (!range.end || info.pts < *range.end);
+
+				if(decoded != shown) {
+					return false;
+				}
+			}
+		}
+
+		for(PacketTimestampInfo& info : m_ts_info) {
+			info.pts -= range.start;
+		}
+
+		m_pts_shift += range.start;
+
+		restrict_packets(begin, end);
+
+		return true;
+	}
+
+	std::vector<bool> VideoFilePktSource::clean_cuts() const {
+		std::vector<bool> clean(m_ts_info.size(), false);
+
+		// The smallest decode index of the packets at or after each one (in presentation order)
+		std::vector<size_t> min_after(m_ts_info.size() + 1, SIZE_MAX);
+
+		for(size_t i = m_ts_info.size(); i-- > 0;) {
+			min_after[i] = std::min(min_after[i + 1], m_ts_info[i].decode_idx);
+		}
+
+		// A keyframe is a clean cut if every packet before it is also decoded before it and every packet after it
+		// is also decoded after it
+		std::optional<size_t> max_before;
+
+		for(size_t i = 0; i < m_ts_info.size(); i++) {
+			const PacketTimestampInfo& info = m_ts_info[i];
+
+			clean[i] = info.keyframe && (!max_before || *max_before < info.decode_idx) && min_after[i] >= info.decode_idx;
+			max_before = std::max(max_before.value_or(0), info.decode_idx);
+		}
+
+		return clean;
+	}
+
+	std::optional<TimeRange> VideoFilePktSource::copyable_range(const TimeRange& range) const {
+		const std::vector<bool> clean = clean_cuts();
+
+		const auto in_range = [&range](int64_t pts) {
+			return pts >= range.start && (!range.end || pts < *range.end);
+		};
+
+		size_t start = 0;
+
+		while(start < m_ts_info.size() && !(clean[start] && in_range(m_ts_info[start].pts))) {
+			start++;
+		}
+
+		if(start == m_ts_info.size()) {
+			return std::nullopt;
+		}
+
+		const int64_t start_pts = m_ts_info[start].pts;
+		const PacketTimestampInfo& last = m_ts_info.back();
+
+		if(!range.end || *range.end >= last.pts + last.duration) {
+			return TimeRange {.start = start_pts, .end = std::nullopt};
+		}
+
+		for(size_t end = m_ts_info.size(); end-- > start + 1;) {
+			if(clean[end] && m_ts_info[end].pts <= *range.end) {
+				return TimeRange {.start = start_pts, .end = m_ts_info[end].pts};
+			}
+		}
+
+		return std::nullopt;
+	}
+
 	const AVCodecParameters *VideoFilePktSource::video_codec() {
+		open();
+
 		return m_ctx->streams[m_stream_idx]->codecpar;
 	}
 
 	std::span<AVStream *> VideoFilePktSource::av_streams() {
+		open();
+
 		return std::span<AVStream *>(m_ctx->streams, m_ctx->nb_streams);
 	}
 
@@ -146,15 +471,20 @@ namespace vcat::filter {
 		return m_dts_shift;
 	}
 
-	TsInfo VideoFilePktSource::pts_end_info() const {
-		auto pkt_info = m_ts_info.back();
+	static TsInfo pts_end_info(std::span<const PacketTimestampInfo> ts_info, int64_t end_padding) {
+		const PacketTimestampInfo& pkt_info = ts_info.back();
 
+		// The padding isn't part of the audio, so the next clip should start where it begins
 		return TsInfo {
 			.ts = pkt_info.pts,
-			.duration = pkt_info.duration
+			.duration = std::max<int64_t>(pkt_info.duration - end_padding, 0)
 		};
 	}
 
+	TsInfo VideoFilePktSource::pts_end_info() const {
+		return filter::pts_end_info(m_ts_info, m_end_padding);
+	}
+
 	VideoFilePktSource::~VideoFilePktSource() {
 		if(m_ctx != nullptr) {
 			avformat_close_input(&m_ctx);
@@ -164,102 +494,403 @@ namespace vcat::filter {
 	VideoFilePktSource::VideoFilePktSource(VideoFilePktSource&& old)
 		: m_ctx(old.m_ctx)
 		, m_span(old.m_span)
+		, m_dts_shift(old.m_dts_shift)
+		, m_stream_idx(old.m_stream_idx)
 		, m_pkt_no(old.m_pkt_no)
+		, m_pts_shift(old.m_pts_shift)
+		, m_end_padding(old.m_end_padding)
+		, m_seek_pts(old.m_seek_pts)
+		, m_keyframes(std::move(old.m_keyframes))
+		, m_type(old.m_type)
+		, m_path(std::move(old.m_path))
+		, m_ts_info(std::move(old.m_ts_info))
 		, m_file(std::move(old.m_file))
 	{
 		old.m_ctx = nullptr;
 	}
 
-	static void calculate_packet_duration(FilterContext& ctx, std::span<vcat::filter::PacketTimestampInfo> ts_info);
-	static void calculate_packet_dts(std::span<vcat::filter::PacketTimestampInfo> ts_info, size_t& dts_shift);
+	// Gets the number of samples to skip at the start and discard at the end of an audio packet
+	// (`AV_PKT_DATA_SKIP_SAMPLES`)
+	static std::pair<uint32_t, uint32_t> skip_samples(const AVPacket *pkt) {
+		size_t size;
+		const uint8_t *data = av_packet_get_side_data(pkt, AV_PKT_DATA_SKIP_SAMPLES, &size);
+
+		if(!data || size < 8) {
+			return {0, 0};
+		}
+
+		uint32_t start;
+		uint32_t end;
+
+		memcpy(&start, data, 4);
+		memcpy(&end, data + 4, 4);
+
+		return {le32toh(start), le32toh(end)};
+	}
+
+	namespace {
+		// A stream that `index_file` is reading the packets of
+		struct StreamScan {
+			StreamIndex index;
+			StreamType  type;
+			size_t      decode_idx;
+			uint32_t    start_skip;
+			uint32_t    end_skip;
+
+			// If set, the packets are taken from the demuxer's index (see `entries_are_complete`), and only the
+			// first packet is read
+			bool                   from_entries;
+			std::optional<int64_t> pts_offset; //< The pts of the first packet minus the timestamp of its index entry
+		};
+	}
+
+	// Checks if the demuxer's index (ie the MP4 sample table) has an entry for every packet of a stream and if the pts of
+	// the packets can be derived from it. The entries only have the dts, so the packets mustn't be reordered.
+	static bool entries_are_complete(const AVStream *stream) {
+		const int count = avformat_index_get_entries_count(stream);
+
+		return
+			count > 0 && count == stream->nb_frames &&
+			(stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || stream->codecpar->video_delay == 0);
+	}
+
+	// Indexes a stream from the demuxer's index without reading its packets (see `entries_are_complete`)
+	static void index_from_entries(Span span, AVStream *stream, StreamScan& scan) {
+		std::vector<PacketTimestampInfo>& ts_info = scan.index.ts_info;
+		const int count = avformat_index_get_entries_count(stream);
+
+		ts_info.reserve(count);
+
+		for(int i = 0; i < count; i++) {
+			const AVIndexEntry *entry = avformat_index_get_entry(stream, i);
+			const int64_t       pts   = av_rescale_q(entry->timestamp + *scan.pts_offset, stream->time_base, constants::TIMEBASE);
+
+			if(!ts_info.empty() && ts_info.back().pts >= pts) {
+				throw error::duplicate_pts(span, entry->timestamp + *scan.pts_offset);
+			}
+
+			// The duration is filled in from the next pts (see `calculate_packet_duration`)
+			ts_info.push_back({
+				.pts = pts,
+				.dts = pts,
+				.duration = 0,
+				.decode_idx = static_cast<size_t>(i),
+				.keyframe = (entry->flags & AVINDEX_KEYFRAME) != 0,
+			});
+		}
+	}
+
+	FileIndex VideoFilePktSource::index_file(FilterContext& fctx, const std::string& path, Span span) {
+		errno = 0;
+		FILE *fp = fopen(path.c_str(), "rb");
+
+		if(errno != 0) {
+			throw error::failed_file_open(span, path);
+		}
+
+		util::VCatAVFile file(fp);
 
-	// Walks through the file to calculate `m_dts_start`, `m_dts_end_info`, `m_pts_end_info`, and `video_idx`
-	//
-	// NOTE: this should be called before the main AVFormatContext is created.
-	void VideoFilePktSource::calculate_info(FilterContext& fctx, StreamType type, const std::string& path) {
 		AVFormatContext *ctx = avformat_alloc_context();
-		ctx->pb = m_file.get();
+		ctx->pb = file.get();
 		ctx->flags |= AVFMT_FLAG_SORT_DTS | AVFMT_FLAG_GENPTS | AVFMT_AVOID_NEG_TS_MAKE_ZERO;
 
-		error::handle_ffmpeg_error(m_span,
+		error::handle_ffmpeg_error(span,
 			avformat_open_input(&ctx, path.c_str(), NULL, NULL)
 		);
 
-		error::handle_ffmpeg_error(m_span,
+		error::handle_ffmpeg_error(span,
 			avformat_find_stream_info(ctx, NULL)
 		);
 
-		const AVMediaType media_type = StreamType_to_AVMediaType(type);
-
-		bool has_stream_idx = false;
-		for(size_t i = 0; i < ctx->nb_streams; i++) {
-			if(ctx->streams[i]->codecpar->codec_type == media_type) {
-				m_stream_idx = i;
-				has_stream_idx = true;
-				break;
+		// Both streams are found in the same pass, so the file is only read once
+		std::vector<StreamScan> scans;
+
+		for(StreamType type : {StreamType::Video, StreamType::Audio}) {
+			const AVMediaType media_type = StreamType_to_AVMediaType(type);
+
+			for(size_t i = 0; i < ctx->nb_streams; i++) {
+				if(ctx->streams[i]->codecpar->codec_type == media_type) {
+					scans.push_back(StreamScan {
+						.index        = {.stream_idx = static_cast<int64_t>(i), .dts_shift = 0, .pts_shift = 0, .end_padding = 0, .ts_info = {}},
+						.type         = type,
+						.decode_idx   = 0,
+						.start_skip   = 0,
+						.end_skip     = 0,
+						.from_entries = entries_are_complete(ctx->streams[i]),
+						.pts_offset   = std::nullopt,
+					});
+					break;
+				}
 			}
 		}
 
-		if(!has_stream_idx) {
-			// TODO: allow for empty streams
-			// we will set a flag and fill in the current stream with an 'blank' version (to match the length
-			// of the other stream)
-			throw error::no_video(m_span, path);
-		}
+		const auto scan_done = [](const StreamScan& scan) {return scan.from_entries && scan.pts_offset;};
+
+		AVPacket *pkt = pool::alloc_packet();
 
-		AVPacket *pkt = av_packet_alloc();
+		while(!std::ranges::all_of(scans, scan_done)) {
+			const int res = av_read_frame(ctx, pkt);
 
-		size_t decode_idx = 0;
-		while(int res = av_read_frame(ctx, pkt) != AVERROR_EOF) {
-			error::handle_ffmpeg_error(m_span,res);
+			if(res == AVERROR_EOF) {
+				break;
+			}
 
-			if(pkt->stream_index != m_stream_idx) {
+			error::handle_ffmpeg_error(span, res);
+
+			const auto scan = std::ranges::find(scans, static_cast<int64_t>(pkt->stream_index), [](const StreamScan& s) {return s.index.stream_idx;});
+
+			if(scan == scans.end() || scan_done(*scan)) {
+				av_packet_unref(pkt);
 				continue;
 			}
 
+			std::vector<PacketTimestampInfo>& ts_info = scan->index.ts_info;
+
 			if(pkt->pts == AV_NOPTS_VALUE) {
-				throw error::no_pts(m_span);
+				throw error::no_pts(span);
+			}
+
+			if(scan->type == StreamType::Audio) {
+				const auto [start, end] = skip_samples(pkt);
+
+				if(scan->decode_idx == 0) {
+					scan->start_skip = start;
+				}
+
+				scan->end_skip = end;
+			}
+
+			// The rest of the stream comes from the index, so its packets don't have to be read at all
+			if(scan->from_entries) {
+				AVStream *stream = ctx->streams[pkt->stream_index];
+
+				scan->pts_offset = pkt->pts - avformat_index_get_entry(stream, 0)->timestamp;
+				stream->discard  = AVDISCARD_ALL;
+
+				av_packet_unref(pkt);
+				continue;
 			}
 
 			const int64_t old_pts = pkt->pts;
 
-			av_packet_rescale_ts(pkt, ctx->streams[m_stream_idx]->time_base, constants::TIMEBASE);
+			av_packet_rescale_ts(pkt, ctx->streams[pkt->stream_index]->time_base, constants::TIMEBASE);
 
 			const int64_t                 pts = pkt->pts;
-			const std::pair<bool, size_t> bsr = binary_search_by(std::span(m_ts_info), [pts](const auto& t) {return t.pts <=> pts;});
+			const std::pair<bool, size_t> bsr = binary_search_by(std::span(ts_info), [pts](const auto& t) {return t.pts <=> pts;});
 			const bool                    found = bsr.first;
 			const size_t                  idx = bsr.second;
 
 			if(found) {
-				throw error::duplicate_pts(m_span, old_pts);
+				throw error::duplicate_pts(span, old_pts);
 			}
 
-			m_ts_info.insert(m_ts_info.begin() + idx, {
+			ts_info.insert(ts_info.begin() + idx, {
 				.pts = pkt->pts,
 				.dts = pkt->dts,
 				.duration = pkt->duration,
-				.decode_idx = decode_idx,
+				.decode_idx = scan->decode_idx,
+				.keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0,
 			});
 
-			decode_idx++;
+			av_packet_unref(pkt);
+			scan->decode_idx++;
 		}
 
-		av_packet_free(&pkt);
+		pool::free_packet(&pkt);
 
-		calculate_packet_duration(fctx, m_ts_info);
-		calculate_packet_dts(m_ts_info, m_dts_shift);
+		FileIndex index {.video = std::nullopt, .audio = std::nullopt};
+
+		for(StreamScan& scan : scans) {
+			StreamIndex& stream = scan.index;
+
+			// NOTE: the padding at the end of an audio stream is only known if its last packet was read
+			if(scan_done(scan)) {
+				index_from_entries(span, ctx->streams[stream.stream_idx], scan);
+			}
+
+			if(scan.type == StreamType::Audio && !stream.ts_info.empty()) {
+				const AVRational sample_tb = AVRational {1, ctx->streams[stream.stream_idx]->codecpar->sample_rate};
+
+				// Like with MP4 edit lists, the encoder priming gets negative timestamps so that the first audible sample is
+				// at 0. Some demuxers already do this and only attach the skip to the first packet.
+				if(stream.ts_info[0].pts >= 0) {
+					stream.pts_shift = av_rescale_q(scan.start_skip, sample_tb, constants::TIMEBASE);
+				}
+
+				for(PacketTimestampInfo& info : stream.ts_info) {
+					info.pts -= stream.pts_shift;
+				}
+
+				if(!scan.from_entries) {
+					stream.end_padding = av_rescale_q(scan.end_skip, sample_tb, constants::TIMEBASE);
+				}
+			}
+
+			calculate_packet_duration(fctx, stream.ts_info);
+			calculate_packet_dts(stream.ts_info, stream.dts_shift);
+
+			(scan.type == StreamType::Video ? index.video : index.audio) = std::move(stream);
+		}
 
 		avformat_close_input(&ctx);
 
-		m_file.reset();
+		return index;
 	}
 
-	std::unique_ptr<FrameSource> VideoFile::get_frames(FilterContext& ctx,StreamType type, Span span) const {
-		auto file = std::make_unique<VideoFilePktSource>(ctx, type, m_path, span);
+	void VideoFile::count_codecs(std::map<AVCodecID, size_t>& counts) const {
+		AVFormatContext *ctx = nullptr;
+
+		// Errors are reported once the file is actually read
+		if(avformat_open_input(&ctx, m_path.c_str(), nullptr, nullptr) < 0) {
+			return;
+		}
+
+		for(unsigned i = 0; i < ctx->nb_streams; i++) {
+			const AVStream *stream = ctx->streams[i];
+
+			// This is the same stream that `VideoFilePktSource` would use
+			if(stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+				counts[stream->codecpar->codec_id] += 1;
+				break;
+			}
+		}
+
+		avformat_close_input(&ctx);
+	}
+
+	const FileIndex& VideoFile::index(FilterContext& ctx, Span span) const {
+		// Packets without a duration last one frame, so the index depends on the framerate
+		if(!m_index || m_index_fps != ctx.vparams.fps) {
+			m_index     = VideoFilePktSource::index_file(ctx, m_path, span);
+			m_index_fps = ctx.vparams.fps;
+		}
+
+		return *m_index;
+	}
+
+	bool VideoFile::codec_matches_output(FilterContext& ctx, StreamType type, Span) const {
+		AVFormatContext *fmt_ctx = nullptr;
+
+		// Errors are reported once the file is actually read
+		if(avformat_open_input(&fmt_ctx, m_path.c_str(), nullptr, nullptr) < 0) {
+			return false;
+		}
+
+		bool matches = false;
+
+		if(avformat_find_stream_info(fmt_ctx, nullptr) >= 0) {
+			const AVMediaType media_type = StreamType_to_AVMediaType(type);
+
+			for(unsigned i = 0; i < fmt_ctx->nb_streams; i++) {
+				const AVCodecParameters *params = fmt_ctx->streams[i]->codecpar;
+
+				// This is the same stream that `VideoFilePktSource` would use
+				if(params->codec_type == media_type) {
+					matches = type == StreamType::Video
+						? util::codec_matches_output(params, ctx.vparams)
+						: util::codec_matches_output(params, ctx.aparams);
+					break;
+				}
+			}
+		}
+
+		avformat_close_input(&fmt_ctx);
+
+		return matches;
+	}
+
+	int64_t VideoFile::video_end(FilterContext& ctx, Span span) const {
+		const std::optional<StreamIndex>& video = index(ctx, span).video;
+
+		if(!video) {
+			throw error::no_video(span, m_path);
+		}
+
+		const TsInfo end = pts_end_info(video->ts_info, video->end_padding);
+
+		return end.ts + end.duration;
+	}
+
+	std::optional<int64_t> VideoFile::container_duration() const {
+		AVFormatContext *ctx = nullptr;
+
+		// Errors are reported once the file is actually read
+		if(avformat_open_input(&ctx, m_path.c_str(), nullptr, nullptr) < 0) {
+			return std::nullopt;
+		}
+
+		std::optional<int64_t> duration;
+
+		if(ctx->duration != AV_NOPTS_VALUE) {
+			duration = av_rescale_q(ctx->duration, AVRational {1, AV_TIME_BASE}, constants::TIMEBASE);
+		}
+
+		avformat_close_input(&ctx);
+
+		return duration;
+	}
+
+	std::optional<int64_t> VideoFile::duration(FilterContext& ctx, Span span) const {
+		return video_end(ctx, span);
+	}
+
+	std::unique_ptr<PacketSource> VideoFile::get_pkts(FilterContext& ctx, StreamType type, Span span) const {
+		if(auto pkts = get_pkts(ctx, type, span, std::nullopt)) {
+			return pkts;
+		}
+
+		return encode(ctx, span, *this, type);
+	}
+
+	std::unique_ptr<PacketSource> VideoFile::get_pkts(FilterContext& ctx, StreamType type, Span span, std::optional<TimeRange> range) const {
+		// A file that has to be re-encoded anyway isn't indexed (the encoded version may already be cached)
+		if(!codec_matches_output(ctx, type, span)) {
+			return nullptr;
+		}
+
+		const FileIndex& index = this->index(ctx, span);
+
+		if(type == StreamType::Video) {
+			auto video = std::make_unique<VideoFilePktSource>(StreamType::Video, m_path, index, span);
+
+			if(range && !video->trim(*range, ctx.allow_preroll)) {
+				return nullptr;
+			}
+
+			if(!ctx.vparams.fixed_fps || video->timestamps_on_grid(util::FrameRateGrid(ctx.vparams.fps))) {
+				return h264::normalize(span, std::move(video), ctx.vparams);
+			}
+
+			return nullptr;
+		}
+
+		auto audio = std::make_unique<VideoFilePktSource>(type, m_path, index, span);
+
+		// The audio is cut/padded to the length of the video so that the clips stay in sync when concatenated
+		int64_t end = video_end(ctx, span);
+
+		if(range) {
+			audio->trim(*range);
+			end = std::min(range->end.value_or(end), end) - range->start;
+		}
+
+		return std::make_unique<AudioFitPktSource>(span, std::move(audio), end, ctx.aparams);
+	}
+
+	std::unique_ptr<FrameSource> VideoFile::get_frames(FilterContext& ctx, StreamType type, Span span) const {
+		return get_frames(ctx, type, span, std::nullopt);
+	}
+
+	std::unique_ptr<FrameSource> VideoFile::get_frames(FilterContext& ctx, StreamType type, Span span, std::optional<TimeRange> range) const {
+		auto file = std::make_unique<VideoFilePktSource>(type, m_path, index(ctx, span), span);
+
+		if(range) {
+			file->seek_range(*range);
+		}
 
 		const AVCodecParameters *codec_params = file->video_codec();
 
-		auto decoded = std::make_unique<Decode>(span, std::move(file));
+		auto decoded = std::make_unique<Decode>(span, std::move(file), type == StreamType::Video ? &ctx.vparams : nullptr);
 
 		if(type == StreamType::Video) {
 			return rescale(
@@ -279,6 +910,14 @@ namespace vcat::filter {
 		}
 	}
 
+	TimeRange VideoFile::snap_range(FilterContext& ctx, Span span, const TimeRange& range) const {
+		return VideoFilePktSource(StreamType::Video, m_path, index(ctx, span), span).snap(range);
+	}
+
+	std::optional<TimeRange> VideoFile::copyable_range(FilterContext& ctx, Span span, const TimeRange& range) const {
+		return VideoFilePktSource(StreamType::Video, m_path, index(ctx, span), span).copyable_range(range);
+	}
+
 	static void calculate_packet_duration(FilterContext& ctx, std::span<vcat::filter::PacketTimestampInfo> ts_info) {
 		for(size_t i = 0; i < ts_info.size(); i++) {
 			if(i + 1 < ts_info.size()) {
@@ -2,6 +2,7 @@
 
 #include "src/filter/filter.hh"
 #include "src/util.hh"
+#include <optional>
 
 namespace vcat::filter {
 	class VideoFile : public VFilter {
@@ -11,14 +12,53 @@ namespace vcat::filter {
 			std::string to_string() const;
 			std::string type_name() const;
 
-			std::unique_ptr<FrameSource> get_frames(FilterContext&, StreamType, Span) const;
+			std::unique_ptr<PacketSource> get_pkts(FilterContext&, StreamType, Span) const;
+			std::unique_ptr<FrameSource>  get_frames(FilterContext&, StreamType, Span) const;
+			void count_codecs(std::map<AVCodecID, size_t>& counts) const;
+
+			// NOTE: if the video has to be re-encoded (ie to change its framerate), the result may be off by a frame
+			std::optional<int64_t> duration(FilterContext&, Span) const;
+
+			// Gets the length that the container reports without reading the packets. This may be missing or
+			// inaccurate, so it should only be used for estimates.
+			std::optional<int64_t> container_duration() const;
+
+			// Gets the packets of part of the video with the start of `range` moved to 0. Returns `nullptr` if this
+			// can't be done without re-encoding.
+			//
+			// NOTE: `range` should be snapped to the video's frames first (see `snap_range`)
+			std::unique_ptr<PacketSource> get_pkts(FilterContext&, StreamType, Span, std::optional<TimeRange> range) const;
+
+			// Gets the frames that are needed to show `range`. Unlike `get_pkts`, the timestamps are left as-is and
+			// frames outside of the range may be included.
+			std::unique_ptr<FrameSource>  get_frames(FilterContext&, StreamType, Span, std::optional<TimeRange> range) const;
+
+			// Moves the ends of a range to the nearest frame boundaries of the video
+			TimeRange snap_range(FilterContext&, Span, const TimeRange& range) const;
+
+			// Finds the largest part of `range` that `get_pkts` can copy without re-encoding (see
+			// `VideoFilePktSource::copyable_range`)
+			std::optional<TimeRange> copyable_range(FilterContext&, Span, const TimeRange& range) const;
 
 			// NOTE: throws `std::string` upon IO failure
 			VideoFile(std::string&& path);
 
 		private:
+			// Gets the index of the file (see `VideoFilePktSource::index_file`). The file is only read once.
+			const FileIndex& index(FilterContext&, Span) const;
+
+			// Gets where the video stream ends. This only uses the index, so it is cheap once the file has been read.
+			int64_t video_end(FilterContext&, Span) const;
+
+			// Checks if the first stream of a type could be copied into the output without re-encoding it. Unlike
+			// indexing the file, this only reads the start of it.
+			bool codec_matches_output(FilterContext&, StreamType, Span) const;
+
 			std::array<uint8_t, vcat::Hasher::HASH_SIZE> m_file_hash;
 			std::string m_path;
+
+			mutable std::optional<FileIndex> m_index;
+			mutable double                   m_index_fps; //< The framerate that `m_index` was made with
 	};
 	static_assert(!std::is_abstract<VideoFile>());
 };
@@ -2,6 +2,8 @@
 #include "src/eval/eobject.hh"
 #include "src/eval/eval.hh"
 #include "src/eval/scope.hh"
+#include "src/filter/frame_cache.hh"
+#include "src/filter/pool.hh"
 #include "src/lexer.hh"
 #include "src/lexer/token.hh"
 #include "src/muxing.hh"
@@ -52,8 +54,15 @@ int main() {
 
 		object.hash(hasher);
 
+		vcat::filter::frame_cache::set_max_bytes(params.frame_cache_size);
+
 		vcat::muxing::write_output(Spanned<const vcat::EObject&>(object, expression->span), params);
 
+		if(params.alloc_stats) {
+			std::cerr << vcat::filter::pool::stats().to_string();
+			std::cerr << vcat::filter::frame_cache::stats();
+		}
+
 	} catch (vcat::Diagnostic d) {
 		std::cout << '\n' << d.render(expression) << '\n';
 	}
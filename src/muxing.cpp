@@ -3,9 +3,14 @@
 #include "src/filter/params.hh"
 #include "src/muxing/error.hh"
 #include "src/filter/filter.hh"
+#include "src/filter/pool.hh"
+#include "src/filter/trim.hh"
 #include "src/muxing/util.hh"
 #include "src/muxing.hh"
 
+#include <cmath>
+#include <optional>
+
 extern "C" {
 	#include "libavcodec/codec_par.h"
 	#include "libavcodec/packet.h"
@@ -14,6 +19,8 @@ extern "C" {
 }
 
 namespace vcat::muxing {
+	static constexpr const char *OUTPUT_PATH = "output.mp4";
+
 	void write_output(Spanned<const vcat::EObject&> eobject, const shared::Parameters& params) {
 		vcat::Span span = eobject.span;
 
@@ -23,12 +30,17 @@ namespace vcat::muxing {
 			throw error::invalid_output(span);
 		}
 
+		const shared::VideoCodec video_codec = params.video_codec == shared::automatic
+			? filter::choose_video_codec(*filter)
+			: params.video_codec;
+
 		filter::FilterContext ctx {
 			filter::VideoParameters {
 				.width     = params.width,
 				.height    = params.height,
 				.fixed_fps = params.fixed_fps,
 				.fps       = params.fps,
+				.codec     = video_codec,
 			},
 			filter::AudioParameters {
 				.sample_rate = static_cast<int>(params.sample_rate),
@@ -37,25 +49,46 @@ namespace vcat::muxing {
 			}
 		};
 
+		AVFormatContext *output = nullptr;
+		error::handle_ffmpeg_error(
+			avformat_alloc_output_context2(&output, nullptr, nullptr, OUTPUT_PATH)
+		);
+
+		// Containers that accept negative timestamps (ie MP4 with edit lists) can hide pre-roll frames at the start
+		// of a range. Otherwise, the start is smart-rendered like the end always is.
+		ctx.allow_preroll = (output->oformat->flags & AVFMT_TS_NEGATIVE) != 0;
+
+		// Only the videos that overlap the range are read, so the rest of the timeline is never rendered
+		std::optional<filter::Trim> range;
+
+		if(params.has_range) {
+			const double timebase = av_q2d(constants::TIMEBASE);
+
+			range.emplace(
+				Spanned<const filter::VFilter&>(*filter, span),
+				filter::TimeRange {
+					.start = std::llround(params.range_start / timebase),
+					.end   = std::isfinite(params.range_end) ? std::optional(std::llround(params.range_end / timebase)) : std::nullopt,
+				}
+			);
+
+			filter = &*range;
+		}
+
 		std::unique_ptr<filter::PacketSource> vsource;
 		std::unique_ptr<filter::PacketSource> asource;
 
 		if(params.lossless) {
 			vsource = filter->get_pkts(ctx, filter::StreamType::Video, span);
+			asource = filter->get_pkts(ctx, filter::StreamType::Audio, span);
 		} else {
 			vsource = encode(ctx, span, *filter, filter::StreamType::Video);
+			asource = encode(ctx, span, *filter, filter::StreamType::Audio);
 		}
 
-		asource = encode(ctx, span, *filter, filter::StreamType::Audio);
-
 		const AVCodecParameters *ivcodec = vsource->video_codec();
 		const AVCodecParameters *iacodec = asource->video_codec();
 
-		AVFormatContext *output = nullptr;
-		error::handle_ffmpeg_error(
-			avformat_alloc_output_context2(&output, nullptr, nullptr, "output.mp4")
-		);
-
 		AVStream *ovstream = avformat_new_stream(output, nullptr);
 
 		AVStream *oastream = avformat_new_stream(output, nullptr);
@@ -76,7 +109,7 @@ namespace vcat::muxing {
 
 		if(!(output->flags & AVFMT_NOFILE)) {
 			error::handle_ffmpeg_error(
-				avio_open(&output->pb, "output.mp4", AVIO_FLAG_WRITE)
+				avio_open(&output->pb, OUTPUT_PATH, AVIO_FLAG_WRITE)
 			);
 		}
 
@@ -100,7 +133,7 @@ namespace vcat::muxing {
 			av_packet_unref(packet);
 		}
 
-		av_packet_free(&packet);
+		filter::pool::free_packet(&packet);
 
 		av_write_trailer(output);
 
@@ -1,21 +1,22 @@
 #include "src/muxing/util.hh"
 #include "src/muxing/error.hh"
+#include "src/filter/pool.hh"
 
 namespace vcat::muxing {
 	PacketInterleaver::PacketInterleaver(std::unique_ptr<filter::PacketSource>&& video, std::unique_ptr<filter::PacketSource>&& audio)
 		: m_video(std::move(video))
 		, m_audio(std::move(audio))
 		, m_video_eof(false)
-		, m_video_buf(av_packet_alloc())
+		, m_video_buf(filter::pool::alloc_packet())
 		, m_audio_eof(false)
-		, m_audio_buf(av_packet_alloc())
+		, m_audio_buf(filter::pool::alloc_packet())
 	{
 		error::handle_ffmpeg_error(m_video_buf && m_audio_buf ? 0 : AVERROR(ENOMEM));
 	}
 
 	bool PacketInterleaver::next(AVPacket **p_output) {
 		if(!*p_output) {
-			*p_output = av_packet_alloc();
+			*p_output = filter::pool::alloc_packet();
 			error::handle_ffmpeg_error(p_output ? 0 : AVERROR(ENOMEM));
 		}
 
@@ -54,8 +55,8 @@ namespace vcat::muxing {
 	}
 
 	PacketInterleaver::~PacketInterleaver() {
-		av_packet_free(&m_video_buf);
-		av_packet_free(&m_audio_buf);
+		filter::pool::free_packet(&m_video_buf);
+		filter::pool::free_packet(&m_audio_buf);
 	}
 }
 
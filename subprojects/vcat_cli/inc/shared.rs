@@ -22,6 +22,13 @@ vcat_def!(
         flt,
     };
 
+    enum VideoCodec {
+        automatic,
+        h264,
+        hevc,
+        av1,
+    };
+
     struct Parameters {
         field(expression, Vector<uint8_t>);
         field(width, int32_t);
@@ -30,10 +37,18 @@ vcat_def!(
         field(lossless, bool);
         field(fixed_fps, bool);
         field(fps, double);
+        field(video_codec, VideoCodec);
 
         field(sample_rate, uint64_t);
         field(sample_format, SampleFormat);
 
+        field(has_range, bool);
+        field(range_start, double);
+        field(range_end, double);
+
+        field(frame_cache_size, uint64_t);
+        field(alloc_stats, bool);
+
         has_destructor();
     };
     rust_drop(Parameters_drop);
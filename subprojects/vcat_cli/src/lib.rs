@@ -7,7 +7,7 @@ mod ffi_macros;
 mod shared;
 mod util;
 
-use shared::{Parameters, SampleFormat};
+use shared::{Parameters, SampleFormat, VideoCodec};
 
 fn get_arg<T>(opt: Option<T>, argument_name: &str, flag: &str) -> T {
     let Some(arg) = opt else {
@@ -101,6 +101,21 @@ argtea_impl! {
             });
         }
 
+        /// Sets the output video codec (`h264`, `hevc`, `av1`, or `auto`) (default `auto`).
+        ///
+        /// `auto` picks `h264` unless every source video already uses `hevc` or `av1`. Only
+        /// `h264` can join copied videos with re-encoded ones (or with copied videos whose
+        /// headers differ). With the other codecs, trims and crossfades are re-encoded entirely,
+        /// and videos with different headers can only be concatenated with `--no-lossless`.
+        (f @ "--codec" | "--video-codec", codec) => {
+            let codec = get_arg(codec, "codec", f);
+
+            video_codec = codec.parse::<VideoCodec>().unwrap_or_else(|_| {
+                eprintln!("vcat: invalid codec `{codec}`");
+                std::process::exit(-1)
+            });
+        }
+
         /// Sets the output sample rate in Hz or kHz (default 48kHz).
         (f @ "--sample-rate" | "--sr", sample_rate) => {
             let sample_rate = get_arg(sample_rate, "sample rate", f);
@@ -123,6 +138,52 @@ argtea_impl! {
             });
         }
 
+        /// Only renders part of the output (`<start>-<end>` or `<start>-`, where the timestamps are
+        /// in seconds or `[[h:]m:]s[.frac]`).
+        ///
+        /// Where possible, the result is identical to the same part of a full render. A start that
+        /// isn't on a keyframe is pre-rolled from the keyframe before it (and hidden with an edit
+        /// list), but an end that isn't on a keyframe still has its last partial GOP re-encoded.
+        (f @ "--range", range) => {
+            let range = get_arg(range, "range", f);
+
+            let parsed = range.split_once('-').and_then(|(start, end)| {
+                let start = util::parse_timestamp(start)?;
+                let end = if end.trim().is_empty() {
+                    f64::INFINITY
+                } else {
+                    util::parse_timestamp(end)?
+                };
+
+                (start < end).then_some((start, end))
+            });
+
+            range_ = Some(parsed.unwrap_or_else(|| {
+                eprintln!("vcat: invalid range `{range}`");
+                std::process::exit(-1)
+            }));
+        }
+
+        /// Sets how much decoded video (in MiB) is kept in memory for videos that are used more
+        /// than once (default 1024).
+        (f @ "--frame-cache-size", size) => {
+            let size = get_arg(size, "frame cache size", f);
+
+            frame_cache_size = size.parse::<u64>()
+                .ok()
+                .and_then(|s| s.checked_mul(1 << 20))
+                .unwrap_or_else(|| {
+                    eprintln!("vcat: invalid frame cache size `{size}`");
+                    std::process::exit(-1)
+                });
+        }
+
+        /// Prints frame, packet, and buffer allocation statistics (and the peak usage of the frame
+        /// cache) after rendering.
+        ("--alloc-stats") => {
+            alloc_stats = true;
+        }
+
         /// Interperets the contents of `file` as a script for generating video.
         (file) => {
             if file.starts_with("-") {
@@ -159,8 +220,12 @@ argtea_impl! {
             let mut lossless = true;
             let mut fixed_fps = true;
             let mut fps_ = 60f64;
+            let mut video_codec = VideoCodec::automatic;
             let mut sample_rate_ = 48_000u64;
             let mut sample_format = SampleFormat::flt;
+            let mut range_: Option<(f64, f64)> = None;
+            let mut frame_cache_size = 1024u64 << 20;
+            let mut alloc_stats = false;
 
             parse!(std::env::args().skip(1));
 
@@ -183,8 +248,14 @@ argtea_impl! {
                 lossless,
                 fixed_fps,
                 fps: fps_,
+                video_codec,
                 sample_rate: sample_rate_,
                 sample_format,
+                has_range: range_.is_some(),
+                range_start: range_.map_or(0.0, |r| r.0),
+                range_end: range_.map_or(f64::INFINITY, |r| r.1),
+                frame_cache_size,
+                alloc_stats,
             };
         }
     }
@@ -76,3 +76,23 @@ impl FromStr for SampleFormat {
         })
     }
 }
+
+impl FromStr for VideoCodec {
+    type Err = ();
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        let s = s
+            .chars()
+            .filter(|c| !c.is_whitespace() && *c != '.')
+            .map(|c| c.to_ascii_lowercase())
+            .collect::<String>();
+
+        Ok(match s.as_str() {
+            "auto" | "automatic" => VideoCodec::automatic,
+            "h264" | "avc" => VideoCodec::h264,
+            "h265" | "hevc" => VideoCodec::hevc,
+            "av1" => VideoCodec::av1,
+            _ => return Err(()),
+        })
+    }
+}
@@ -29,3 +29,24 @@ pub fn parse_hertz(input: &str) -> Option<u64> {
     // Fall back to Hz if no unit is specified
     input.parse::<u64>().ok()
 }
+
+/// Parses a timestamp of the form `[[h:]m:]s[.frac]` into seconds
+pub fn parse_timestamp(input: &str) -> Option<f64> {
+    let parts = input.trim().split(':').collect::<Vec<_>>();
+
+    if parts.len() > 3 {
+        return None;
+    }
+
+    let (seconds, rest) = parts.split_last()?;
+
+    let seconds = seconds
+        .parse::<f64>()
+        .ok()
+        .filter(|s| s.is_finite() && *s >= 0.0)?;
+
+    rest.iter().try_fold(0f64, |total, part| {
+        part.parse::<u64>().ok().map(|v| total * 60.0 + v as f64)
+    })
+    .map(|total| total * 60.0 + seconds)
+}